@@ -117,4 +117,73 @@ BENCHMARK(BM_ClientProcessResponse)
     ->RangeMultiplier(2)
     ->Range(1 << 16, 1 << 16);
 
+// Serializes and loads back one kind of object of a request or response with
+// the given compression. Reports the encoded size, to weigh the bytes saved
+// against the time spent.
+void BM_Compression(benchmark::State& state) {
+  constexpr std::size_t dbsize = 1 << 16;
+  auto db = generateDB(dbsize);
+  auto params =
+      CreatePIRParameters(db.size(), ITEM_SIZE, DIMENSIONS).ValueOrDie();
+  auto pirdb = PIRDatabase::Create(db, params).ValueOrDie();
+  auto server_ = PIRServer::Create(pirdb, params).ValueOrDie();
+  auto client_ = PIRClient::Create(params).ValueOrDie();
+  auto sealctx = server_->Context()->SEALContext();
+
+  std::vector<size_t> desiredIndex = {dbsize - 1};
+  auto request = client_->CreateRequest(desiredIndex).ValueOrDie();
+  auto response = server_->ProcessRequest(request).ValueOrDie();
+
+  const auto compr_mode =
+      ComprMode(static_cast<Compression>(state.range(1))).ValueOrDie();
+  std::string encoded;
+  int64_t bytes_processed = 0;
+
+  switch (state.range(0)) {
+    case 0: {
+      auto query = LoadCiphertexts(sealctx, request.query(0)).ValueOrDie();
+      for (auto _ : state) {
+        SEALSerialize(query[0], &encoded, compr_mode);
+        auto out = SEALDeserialize<seal::Ciphertext>(sealctx, encoded);
+        ::benchmark::DoNotOptimize(out);
+        bytes_processed += encoded.size();
+      }
+      break;
+    }
+    case 1: {
+      auto galois_keys =
+          SEALDeserialize<seal::GaloisKeys>(sealctx, request.galois_keys())
+              .ValueOrDie();
+      for (auto _ : state) {
+        SEALSerialize(galois_keys, &encoded, compr_mode);
+        auto out = SEALDeserialize<seal::GaloisKeys>(sealctx, encoded);
+        ::benchmark::DoNotOptimize(out);
+        bytes_processed += encoded.size();
+      }
+      break;
+    }
+    default: {
+      auto reply = LoadCiphertexts(sealctx, response.reply(0)).ValueOrDie();
+      for (auto _ : state) {
+        SEALSerialize(reply[0], &encoded, compr_mode);
+        auto out = SEALDeserialize<seal::Ciphertext>(sealctx, encoded);
+        ::benchmark::DoNotOptimize(out);
+        bytes_processed += encoded.size();
+      }
+    }
+  }
+  state.counters["EncodedBytes"] = static_cast<double>(encoded.size());
+  state.SetBytesProcessed(bytes_processed);
+}
+// First argument is the object: 0 for a query ciphertext, 1 for the Galois
+// keys and 2 for a reply ciphertext. Second argument is the Compression.
+void CompressionArgs(benchmark::internal::Benchmark* b) {
+  for (int object = 0; object < 3; ++object) {
+    for (int compression : {COMPRESSION_NONE, COMPRESSION_DEFLATE}) {
+      b->Args({object, compression});
+    }
+  }
+}
+BENCHMARK(BM_Compression)->Apply(CompressionArgs);
+
 }  // namespace pir
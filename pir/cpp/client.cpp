@@ -16,7 +16,7 @@
 #include "pir/cpp/client.h"
 
 #include "absl/memory/memory.h"
-#include "pir/cpp/database.h"
+#include "pir/cpp/key_cache.h"
 #include "pir/cpp/string_encoder.h"
 #include "pir/cpp/utils.h"
 #include "seal/seal.h"
@@ -36,10 +36,14 @@ using ::seal::RelinKeys;
 
 PIRClient::PIRClient(std::unique_ptr<PIRContext> context)
     : context_(std::move(context)) {
+  resetKeys();
+}
+
+void PIRClient::resetKeys() {
   auto sealctx = context_->SEALContext();
   keygen_ = std::make_unique<seal::KeyGenerator>(sealctx);
-  encryptor_ =
-      std::make_shared<seal::Encryptor>(sealctx, keygen_->public_key());
+  encryptor_ = std::make_shared<seal::Encryptor>(
+      sealctx, keygen_->public_key(), keygen_->secret_key());
   decryptor_ =
       std::make_shared<seal::Decryptor>(sealctx, keygen_->secret_key());
 }
@@ -50,6 +54,51 @@ StatusOr<std::unique_ptr<PIRClient>> PIRClient::Create(
   return absl::WrapUnique(new PIRClient(std::move(context)));
 }
 
+void PIRClient::RotateKeys() {
+  // The pool holds on to the old encryptor, so it has to go first.
+  zero_pool_.reset();
+  resetKeys();
+  set_encryption_pool(zero_pool_options_);
+  std::lock_guard<std::mutex> lock(request_keys_mutex_);
+  request_keys_.reset();
+}
+
+void PIRClient::set_encryption_pool(
+    const ZeroEncryptionPool::Options& options) {
+  zero_pool_options_ = options;
+  zero_pool_.reset();
+  if (options.depth > 0) {
+    zero_pool_ = std::make_unique<ZeroEncryptionPool>(encryptor_, options);
+  }
+}
+
+Status PIRClient::FillEncryptionPool() {
+  if (zero_pool_ == nullptr) {
+    return Status::OK;
+  }
+  return zero_pool_->Fill();
+}
+
+void PIRClient::set_seeded_requests(bool seeded) {
+  std::lock_guard<std::mutex> lock(request_keys_mutex_);
+  if (seeded != seeded_requests_) {
+    seeded_requests_ = seeded;
+    request_keys_.reset();
+  }
+}
+
+Status PIRClient::set_compression(const WireCompression& compression) {
+  RETURN_IF_ERROR(ComprMode(compression.query).status());
+  RETURN_IF_ERROR(ComprMode(compression.keys).status());
+  RETURN_IF_ERROR(ComprMode(compression.response).status());
+  std::lock_guard<std::mutex> lock(request_keys_mutex_);
+  if (compression.keys != compression_.keys) {
+    request_keys_.reset();
+  }
+  compression_ = compression;
+  return Status::OK;
+}
+
 StatusOr<uint64_t> InvertMod(uint64_t m, const seal::Modulus& mod) {
   if (mod.uint64_count() > 1) {
     return InternalError("Modulus too big to invert");
@@ -63,33 +112,118 @@ StatusOr<uint64_t> InvertMod(uint64_t m, const seal::Modulus& mod) {
 
 StatusOr<Request> PIRClient::CreateRequest(
     const std::vector<std::size_t>& indexes) const {
-  const auto poly_modulus_degree =
-      context_->EncryptionParams().poly_modulus_degree();
-
-  vector<vector<Ciphertext>> queries(indexes.size());
+  ASSIGN_OR_RETURN(auto query_compr_mode, ComprMode(compression_.query));
+  Request request_proto;
 
+  // Query slots are allocated up front so that each one can be written from a
+  // different thread, keeping queries in the same order as the indexes.
   for (size_t i = 0; i < indexes.size(); ++i) {
-    RETURN_IF_ERROR(createQueryFor(indexes[i], queries[i]));
+    request_proto.add_query();
+  }
+  RETURN_IF_ERROR(
+      ParallelFor(thread_pool_.get(), indexes.size(), [&](size_t i) {
+        vector<Plaintext> query;
+        RETURN_IF_ERROR(createQueryFor(indexes[i], query));
+        return encryptQuery(query, query_compr_mode,
+                            request_proto.mutable_query(i));
+      }));
+
+  bool first_use;
+  ASSIGN_OR_RETURN(auto keys, requestKeys(&first_use));
+  if (!send_keys_once_ || first_use) {
+    request_proto.set_galois_keys(keys->galois_keys);
+    request_proto.set_relin_keys(keys->relin_keys);
   }
+  request_proto.set_key_id(keys->key_id);
+  request_proto.set_response_compression(compression_.response);
 
-  GaloisKeys gal_keys;
-  RelinKeys relin_keys;
+  return request_proto;
+}
+
+Status PIRClient::AddKeys(Request* request) const {
+  ASSIGN_OR_RETURN(auto keys, requestKeys());
+  if (request->key_id() != keys->key_id) {
+    return InvalidArgumentError("Request was created with other keys");
+  }
+  request->set_galois_keys(keys->galois_keys);
+  request->set_relin_keys(keys->relin_keys);
+  return Status::OK;
+}
+
+Status PIRClient::encryptQuery(const vector<Plaintext>& query,
+                               seal::compr_mode_type compr_mode,
+                               Ciphertexts* output) const {
   try {
-    gal_keys =
-        keygen_->galois_keys_local(generate_galois_elts(poly_modulus_degree));
-    relin_keys = keygen_->relin_keys_local();
+    if (seeded_requests_) {
+      // Seeded ciphertexts can only be serialized, so they are saved straight
+      // into the request.
+      vector<seal::Serializable<Ciphertext>> cts;
+      cts.reserve(query.size());
+      for (const auto& pt : query) {
+        cts.push_back(encryptor_->encrypt_symmetric(pt));
+      }
+      return SaveCiphertexts(cts, output, compr_mode);
+    }
+    vector<Ciphertext> cts(query.size());
+    for (size_t c = 0; c < query.size(); ++c) {
+      if (zero_pool_ != nullptr) {
+        RETURN_IF_ERROR(zero_pool_->Pop(cts[c]));
+        context_->Evaluator()->add_plain_inplace(cts[c], query[c]);
+      } else {
+        encryptor_->encrypt(query[c], cts[c]);
+      }
+    }
+    return SaveCiphertexts(cts, output, compr_mode);
   } catch (const std::exception& e) {
     return InternalError(e.what());
   }
+}
+
+StatusOr<std::shared_ptr<const PIRClient::RequestKeys>>
+PIRClient::requestKeys(bool* first_use) const {
+  std::lock_guard<std::mutex> lock(request_keys_mutex_);
+  if (request_keys_ != nullptr) {
+    if (first_use != nullptr) {
+      *first_use = !keys_used_;
+      keys_used_ = true;
+    }
+    return request_keys_;
+  }
 
-  Request request_proto;
-  RETURN_IF_ERROR(SaveRequest(queries, gal_keys, relin_keys, &request_proto));
+  ASSIGN_OR_RETURN(auto compr_mode, ComprMode(compression_.keys));
+  auto keys = std::make_shared<RequestKeys>();
+  const auto galois_elts = context_->GaloisElements();
+  try {
+    if (seeded_requests_) {
+      RETURN_IF_ERROR(SEALSerialize(keygen_->galois_keys(galois_elts),
+                                    &keys->galois_keys, compr_mode));
+      if (context_->NeedsRelinKeys()) {
+        RETURN_IF_ERROR(SEALSerialize(keygen_->relin_keys(), &keys->relin_keys,
+                                      compr_mode));
+      }
+    } else {
+      RETURN_IF_ERROR(SEALSerialize(keygen_->galois_keys_local(galois_elts),
+                                    &keys->galois_keys, compr_mode));
+      if (context_->NeedsRelinKeys()) {
+        RETURN_IF_ERROR(SEALSerialize(keygen_->relin_keys_local(),
+                                      &keys->relin_keys, compr_mode));
+      }
+    }
+  } catch (const std::exception& e) {
+    return InternalError(e.what());
+  }
+  keys->key_id = KeyDigest(keys->galois_keys, keys->relin_keys);
 
-  return request_proto;
+  request_keys_ = std::move(keys);
+  keys_used_ = first_use != nullptr;
+  if (first_use != nullptr) {
+    *first_use = true;
+  }
+  return request_keys_;
 }
 
 Status PIRClient::createQueryFor(size_t desired_index,
-                                 vector<Ciphertext>& query) const {
+                                 vector<Plaintext>& query) const {
   if (desired_index >= context_->Params()->num_items()) {
     return InvalidArgumentError("invalid index " +
                                 std::to_string(desired_index));
@@ -98,68 +232,78 @@ Status PIRClient::createQueryFor(size_t desired_index,
   const auto poly_modulus_degree =
       context_->EncryptionParams().poly_modulus_degree();
 
-  ASSIGN_OR_RETURN(auto pirdb, PIRDatabase::Create(context_->Params()));
-  auto dims = std::vector<uint32_t>(context_->Params()->dimensions().begin(),
-                                    context_->Params()->dimensions().end());
-  auto indices = pirdb->calculate_indices(desired_index);
+  const auto& planner = context_->Planner();
+  const auto& dims = planner.dimensions();
+  vector<uint32_t> indices;
+  indices.reserve(dims.size());
+  planner.calculate_indices(desired_index, indices);
 
   const size_t dim_sum = context_->DimensionsSum();
 
   size_t offset = 0;
+  // Dimension being placed, and how much of it went into earlier plaintexts.
+  size_t d = 0;
+  size_t placed = 0;
   query.resize(dim_sum / poly_modulus_degree + 1);
   for (size_t c = 0; c < query.size(); ++c) {
-    Plaintext pt(poly_modulus_degree);
+    Plaintext& pt = query[c];
+    pt.resize(poly_modulus_degree);
     pt.set_zero();
 
-    while (!indices.empty()) {
-      if (indices[0] + offset >= poly_modulus_degree) {
+    while (d < dims.size()) {
+      if (indices[d] - placed + offset >= poly_modulus_degree) {
         // no more slots in this poly
-        indices[0] -= (poly_modulus_degree - offset);
-        dims[0] -= (poly_modulus_degree - offset);
+        placed += poly_modulus_degree - offset;
         offset = 0;
         break;
       }
       uint64_t m = (c < query.size() - 1)
                        ? poly_modulus_degree
                        : next_power_two(dim_sum % poly_modulus_degree);
-      ASSIGN_OR_RETURN(pt[indices[0] + offset], InvertMod(m, plain_mod));
-      offset += dims[0];
-      indices.erase(indices.begin());
-      dims.erase(dims.begin());
+      ASSIGN_OR_RETURN(pt[indices[d] - placed + offset],
+                       InvertMod(m, plain_mod));
+      offset += dims[d] - placed;
+      placed = 0;
+      ++d;
 
       if (offset >= poly_modulus_degree) {
         offset -= poly_modulus_degree;
         break;
       }
     }
-
-    try {
-      encryptor_->encrypt(pt, query[c]);
-    } catch (const std::exception& e) {
-      return InternalError(e.what());
-    }
   }
 
   return Status::OK;
 }
 
+Status PIRClient::decryptReply(const Ciphertexts& reply_proto,
+                               Plaintext& plaintext) const {
+  ASSIGN_OR_RETURN(auto reply,
+                   LoadCiphertexts(context_->SEALContext(), reply_proto));
+  if (reply.size() != 1) {
+    return InvalidArgumentError("Number of ciphertexts in reply must be 1");
+  }
+  try {
+    decryptor_->decrypt(reply[0], plaintext);
+  } catch (const std::exception& e) {
+    return InternalError(e.what());
+  }
+  return Status::OK;
+}
+
 StatusOr<std::vector<int64_t>> PIRClient::ProcessResponseInteger(
     const Response& response_proto) const {
-  vector<int64_t> result;
-  result.reserve(response_proto.reply_size());
-  for (const auto& r : response_proto.reply()) {
-    ASSIGN_OR_RETURN(auto reply, LoadCiphertexts(context_->SEALContext(), r));
-    if (reply.size() != 1) {
-      return InvalidArgumentError("Number of ciphertexts in reply must be 1");
-    }
+  vector<int64_t> result(response_proto.reply_size());
+  RETURN_IF_ERROR(ParallelFor(thread_pool_.get(), result.size(), [&](size_t i) {
     seal::Plaintext plaintext;
+    RETURN_IF_ERROR(decryptReply(response_proto.reply(i), plaintext));
     try {
-      decryptor_->decrypt(reply[0], plaintext);
-      result.push_back(context_->Encoder()->decode_int64(plaintext));
+      result[i] = context_->Encoder()->decode_int64(plaintext);
     } catch (const std::exception& e) {
       return InternalError(e.what());
     }
-  }
+    return Status::OK;
+  }));
   return result;
 }
 
@@ -171,30 +315,21 @@ StatusOr<std::vector<string>> PIRClient::ProcessResponse(
         "Number of indexes must match number of replies");
   }
 
-  ASSIGN_OR_RETURN(auto pirdb, PIRDatabase::Create(context_->Params()));
+  const auto& planner = context_->Planner();
   StringEncoder encoder(context_->SEALContext());
   if (context_->Params()->bits_per_coeff() > 0) {
     encoder.set_bits_per_coeff(context_->Params()->bits_per_coeff());
   }
-  vector<string> result;
-  result.reserve(response_proto.reply_size());
-  for (size_t i = 0; i < indexes.size(); ++i) {
-    ASSIGN_OR_RETURN(auto reply, LoadCiphertexts(context_->SEALContext(),
-                                                 response_proto.reply(i)));
-    if (reply.size() != 1) {
-      return InvalidArgumentError("Number of ciphertexts in reply must be 1");
-    }
+  const size_t bytes_per_item = context_->Params()->bytes_per_item();
+  vector<string> result(indexes.size());
+  RETURN_IF_ERROR(ParallelFor(thread_pool_.get(), result.size(), [&](size_t i) {
     seal::Plaintext plaintext;
-    try {
-      decryptor_->decrypt(reply[0], plaintext);
-    } catch (const std::exception& e) {
-      return InternalError(e.what());
-    }
-    ASSIGN_OR_RETURN(
-        auto v, encoder.decode(plaintext, context_->Params()->bytes_per_item(),
-                               pirdb->calculate_item_offset(indexes[i])));
-    result.push_back(v);
-  }
+    RETURN_IF_ERROR(decryptReply(response_proto.reply(i), plaintext));
+    ASSIGN_OR_RETURN(result[i],
+                     encoder.decode(plaintext, bytes_per_item,
+                                    planner.calculate_item_offset(indexes[i])));
+    return Status::OK;
+  }));
   return result;
 }
 }  // namespace pir
@@ -17,10 +17,13 @@
 #ifndef PIR_CLIENT_H_
 #define PIR_CLIENT_H_
 
+#include <mutex>
 #include <string>
 
 #include "pir/cpp/context.h"
 #include "pir/cpp/serialization.h"
+#include "pir/cpp/thread_pool.h"
+#include "pir/cpp/zero_encryption_pool.h"
 #include "util/statusor.h"
 
 namespace pir {
@@ -45,6 +48,10 @@ class PIRClient {
    * of ciphertexts. It is expected that the server will first expand the
    * request ciphertexts, and then split them into vectors by the dimensions
    * given in context.
+   *
+   * Galois and relinearization keys are generated and serialized on the first
+   * request only, and the same bytes and key_id are sent with every request
+   * until RotateKeys is called, or only the key_id, see set_send_keys_once.
    * @param[in] desiredIndex Expected database value from an index
    * @returns InvalidArgument if the index is invalid or if the encryption fails
    **/
@@ -71,13 +78,127 @@ class PIRClient {
   StatusOr<std::vector<int64_t>> ProcessResponseInteger(
       const Response& response) const;
 
+  /**
+   * Replaces the secret key, and with it the keys sent in requests, which are
+   * generated again on the next request. The encryption pool, if any, is
+   * emptied and filled again under the new key. Replies to requests created
+   * before the rotation can no longer be decrypted. Must not be called
+   * concurrently with other methods.
+   */
+  void RotateKeys();
+
   PIRClient() = delete;
 
+  /**
+   * Sets a thread pool used to build and encrypt the queries of a request, and
+   * to decrypt and decode the replies of a response, concurrently. The SEAL
+   * encryptor and decryptor are safe to share between threads, so all threads
+   * use the same ones. If not set, or set to nullptr, everything runs on the
+   * calling thread.
+   */
+  void set_thread_pool(std::shared_ptr<ThreadPool> pool) {
+    thread_pool_ = pool;
+  }
+
+  /**
+   * If set, queries are encrypted with the secret key and keys are generated
+   * in seeded form, so that a seed is sent in place of the uniformly random
+   * half of each ciphertext and key, roughly halving the size of a request.
+   * Servers load seeded requests like any other.
+   */
+  void set_seeded_requests(bool seeded);
+
+  /**
+   * Sets the compression of the queries and keys in requests, and the
+   * compression asked of the server for replies. Nothing is compressed by
+   * default.
+   * @returns InvalidArgument if SEAL doesn't support one of the compressions.
+   */
+  Status set_compression(const WireCompression& compression);
+
+  /**
+   * If set, the key bytes are only sent with the first request after the keys
+   * are generated, and later requests only carry their key_id. Meant for
+   * servers with a KeyCache, which keep the keys under their key_id. If the
+   * server replies NotFound to a request, because it never got the keys or
+   * evicted them, add them back with AddKeys and send the request again.
+   */
+  void set_send_keys_once(bool once) { send_keys_once_ = once; }
+
+  /**
+   * Adds the key bytes to a request that only carries their key_id, such as
+   * one the server replied NotFound to.
+   * @returns InvalidArgument if the request was created with other keys, for
+   *    example before RotateKeys.
+   */
+  Status AddKeys(Request* request) const;
+
+  /**
+   * Keeps a pool of encryptions of zero computed ahead of time, so that
+   * encrypting a query only takes adding its plaintext to one of them. This
+   * moves almost all of the work of CreateRequest off the calling thread.
+   * Seeded requests are always encrypted on the spot, as the pool only holds
+   * public key encryptions.
+   * @param[in] options Depth and refill policy of the pool. A depth of zero
+   *    removes the pool.
+   */
+  void set_encryption_pool(const ZeroEncryptionPool::Options& options);
+
+  /**
+   * Fills the encryption pool on the calling thread, such as while the
+   * application is idle, for pools without background refill. Does nothing if
+   * there is no pool.
+   * @returns InternalError if the encryption fails.
+   */
+  Status FillEncryptionPool();
+
  private:
+  // Serialized keys sent with every request, see requestKeys.
+  struct RequestKeys {
+    string galois_keys;
+    string relin_keys;
+    string key_id;
+  };
+
   PIRClient(std::unique_ptr<PIRContext>);
-  Status createQueryFor(size_t desired_index, vector<Ciphertext>& query) const;
+
+  // Generates a new secret key, and the encryptor and decryptor using it.
+  void resetKeys();
+
+  // Encodes the selection vector plaintexts of the query for an index.
+  Status createQueryFor(size_t desired_index,
+                        vector<seal::Plaintext>& query) const;
+
+  // Encrypts the plaintexts of a query and saves them to output.
+  Status encryptQuery(const vector<seal::Plaintext>& query,
+                      seal::compr_mode_type compr_mode,
+                      Ciphertexts* output) const;
+
+  // Returns the serialized keys for requests, generating them on first use.
+  // Only keys the server will actually use are generated. If first_use is not
+  // null, it is set to whether these keys were never asked for with it
+  // before, which is when set_send_keys_once sends them.
+  StatusOr<std::shared_ptr<const RequestKeys>> requestKeys(
+      bool* first_use = nullptr) const;
+
+  // Decrypts a reply, which must be a single ciphertext.
+  Status decryptReply(const Ciphertexts& reply,
+                      seal::Plaintext& plaintext) const;
 
   std::unique_ptr<PIRContext> context_;
+  std::shared_ptr<ThreadPool> thread_pool_;
+  bool seeded_requests_ = false;
+  bool send_keys_once_ = false;
+  WireCompression compression_;
+
+  // Guards request_keys_ and keys_used_, which are filled in lazily by const
+  // methods.
+  mutable std::mutex request_keys_mutex_;
+  mutable std::shared_ptr<const RequestKeys> request_keys_;
+  mutable bool keys_used_ = false;
+
+  ZeroEncryptionPool::Options zero_pool_options_ = {/*depth=*/0};
+  std::unique_ptr<ZeroEncryptionPool> zero_pool_;
 
   std::unique_ptr<seal::KeyGenerator> keygen_;
   std::shared_ptr<seal::Encryptor> encryptor_;
@@ -51,6 +51,24 @@ class PIRClientTest : public ::testing::Test {
     ASSERT_TRUE(client_ != nullptr);
   }
 
+  // Creates a server for a database of integers with db[i] = i * 7 + 3.
+  void SetUpServer() {
+    int_db_.resize(db_size_);
+    for (size_t i = 0; i < int_db_.size(); ++i) {
+      int_db_[i] = i * 7 + 3;
+    }
+    ASSIGN_OR_FAIL(auto pir_db, PIRDatabase::Create(int_db_, pir_params_));
+    server_ = PIRServer::Create(pir_db, pir_params_).ValueOrDie();
+    ASSERT_THAT(server_, NotNull());
+  }
+
+  // Creates a server for a database of strings.
+  void SetUpServer(const vector<string>& db) {
+    ASSIGN_OR_FAIL(auto pir_db, PIRDatabase::Create(db, pir_params_));
+    server_ = PIRServer::Create(pir_db, pir_params_).ValueOrDie();
+    ASSERT_THAT(server_, NotNull());
+  }
+
   const auto& Context() { return client_->context_; }
   std::shared_ptr<seal::Decryptor> Decryptor() { return client_->decryptor_; }
   std::shared_ptr<seal::Encryptor> Encryptor() { return client_->encryptor_; }
@@ -59,6 +77,8 @@ class PIRClientTest : public ::testing::Test {
   shared_ptr<PIRParameters> pir_params_;
   EncryptionParameters encryption_params_;
   std::unique_ptr<PIRClient> client_;
+  vector<std::int64_t> int_db_;
+  std::unique_ptr<PIRServer> server_;
 };
 
 TEST_F(PIRClientTest, TestCreateRequest) {
@@ -84,6 +104,156 @@ TEST_F(PIRClientTest, TestCreateRequest) {
   }
 }
 
+TEST_F(PIRClientTest, TestCreateRequestMinimalKeys) {
+  ASSIGN_OR_FAIL(auto request_proto, client_->CreateRequest({5}));
+  // Single dimension databases are never relinearized.
+  EXPECT_THAT(request_proto.relin_keys(), IsEmpty());
+
+  ASSIGN_OR_FAIL(auto galois_keys,
+                 SEALDeserialize<GaloisKeys>(Context()->SEALContext(),
+                                             request_proto.galois_keys()));
+  // 100 items only need 7 levels of expansion.
+  const auto galois_elts = Context()->GaloisElements();
+  ASSERT_THAT(galois_elts, SizeIs(7));
+  EXPECT_THAT(galois_keys.size(), Eq(galois_elts.size()));
+  for (auto galois_elt : galois_elts) {
+    EXPECT_TRUE(galois_keys.has_key(galois_elt)) << galois_elt;
+  }
+}
+
+TEST_F(PIRClientTest, TestCreateRequestReusesKeys) {
+  SetUpDB(84, 2);
+  ASSIGN_OR_FAIL(auto first, client_->CreateRequest({5}));
+  ASSIGN_OR_FAIL(auto second, client_->CreateRequest({42}));
+  // Keys are generated once, so later requests carry the very same bytes.
+  EXPECT_THAT(second.galois_keys(), Eq(first.galois_keys()));
+  EXPECT_THAT(second.relin_keys(), Eq(first.relin_keys()));
+  EXPECT_THAT(second.key_id(), Eq(first.key_id()));
+  EXPECT_THAT(second.query(0).ct(0), Ne(first.query(0).ct(0)));
+
+  // Changing the encoding of the keys generates them again.
+  client_->set_seeded_requests(true);
+  ASSIGN_OR_FAIL(auto seeded, client_->CreateRequest({5}));
+  EXPECT_THAT(seeded.key_id(), Ne(first.key_id()));
+}
+
+TEST_F(PIRClientTest, TestRotateKeys) {
+  SetUpDB(84, 2);
+  SetUpServer();
+
+  ASSIGN_OR_FAIL(auto before, client_->CreateRequest({5}));
+  client_->RotateKeys();
+  ASSIGN_OR_FAIL(auto request, client_->CreateRequest({42}));
+  EXPECT_THAT(request.galois_keys(), Ne(before.galois_keys()));
+  EXPECT_THAT(request.key_id(), Ne(before.key_id()));
+
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request));
+  ASSIGN_OR_FAIL(auto result, client_->ProcessResponseInteger(response));
+  EXPECT_THAT(result, ElementsAre(int_db_[42]));
+}
+
+TEST_F(PIRClientTest, TestSendKeysOnce) {
+  SetUpDB(84, 2);
+  SetUpServer();
+  server_->set_key_cache(std::make_shared<KeyCache>(4));
+  client_->set_send_keys_once(true);
+
+  ASSIGN_OR_FAIL(auto first, client_->CreateRequest({42}));
+  EXPECT_THAT(first.galois_keys(), Not(IsEmpty()));
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(first));
+  ASSIGN_OR_FAIL(auto result, client_->ProcessResponseInteger(response));
+  EXPECT_THAT(result, ElementsAre(int_db_[42]));
+
+  // Later requests only carry the key_id, which the server has cached.
+  ASSIGN_OR_FAIL(auto request, client_->CreateRequest({5}));
+  EXPECT_THAT(request.galois_keys(), IsEmpty());
+  EXPECT_THAT(request.relin_keys(), IsEmpty());
+  EXPECT_THAT(request.key_id(), Eq(first.key_id()));
+  ASSIGN_OR_FAIL(response, server_->ProcessRequest(request));
+  ASSIGN_OR_FAIL(result, client_->ProcessResponseInteger(response));
+  EXPECT_THAT(result, ElementsAre(int_db_[5]));
+
+  // A server that lost the keys asks for them, and they are sent again.
+  server_->set_key_cache(std::make_shared<KeyCache>(4));
+  ASSIGN_OR_FAIL(request, client_->CreateRequest({7}));
+  EXPECT_THAT(server_->ProcessRequest(request).status().code(),
+              Eq(private_join_and_compute::StatusCode::kNotFound));
+  ASSERT_OK(client_->AddKeys(&request));
+  ASSIGN_OR_FAIL(response, server_->ProcessRequest(request));
+  ASSIGN_OR_FAIL(result, client_->ProcessResponseInteger(response));
+  EXPECT_THAT(result, ElementsAre(int_db_[7]));
+
+  client_->RotateKeys();
+  EXPECT_THAT(client_->AddKeys(&request).code(),
+              Eq(private_join_and_compute::StatusCode::kInvalidArgument));
+}
+
+TEST_F(PIRClientTest, TestCreateRequestEncryptionPool) {
+  SetUpDB(84, 2);
+  SetUpServer();
+
+  ZeroEncryptionPool::Options options;
+  options.depth = 2;
+  options.background_refill = false;
+  client_->set_encryption_pool(options);
+  ASSERT_OK(client_->FillEncryptionPool());
+
+  // Queries are answered the same whether the pool is full or has run dry.
+  const vector<size_t> indices = {42, 5, 83};
+  ASSIGN_OR_FAIL(auto request, client_->CreateRequest(indices));
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request));
+  ASSIGN_OR_FAIL(auto result, client_->ProcessResponseInteger(response));
+  EXPECT_THAT(result, ElementsAre(int_db_[42], int_db_[5], int_db_[83]));
+
+  client_->RotateKeys();
+  ASSIGN_OR_FAIL(request, client_->CreateRequest({7}));
+  ASSIGN_OR_FAIL(response, server_->ProcessRequest(request));
+  ASSIGN_OR_FAIL(result, client_->ProcessResponseInteger(response));
+  EXPECT_THAT(result, ElementsAre(int_db_[7]));
+}
+
+TEST_F(PIRClientTest, TestCreateRequestSeeded) {
+  SetUpDB(84, 2);
+  const size_t desired_index = 42;
+  ASSIGN_OR_FAIL(auto full_request, client_->CreateRequest({desired_index}));
+  client_->set_seeded_requests(true);
+  ASSIGN_OR_FAIL(auto seeded_request, client_->CreateRequest({desired_index}));
+
+  // Seeds replace half of every ciphertext and key.
+  ASSERT_EQ(seeded_request.query_size(), 1);
+  EXPECT_LT(seeded_request.query(0).ByteSizeLong(),
+            full_request.query(0).ByteSizeLong() * 3 / 5);
+  EXPECT_LT(seeded_request.galois_keys().size(),
+            full_request.galois_keys().size() * 3 / 5);
+  EXPECT_LT(seeded_request.relin_keys().size(),
+            full_request.relin_keys().size() * 3 / 5);
+
+  // The query still decrypts to the same selection vectors.
+  ASSIGN_OR_FAIL(auto full_query, LoadCiphertexts(Context()->SEALContext(),
+                                                  full_request.query(0)));
+  ASSIGN_OR_FAIL(auto seeded_query, LoadCiphertexts(Context()->SEALContext(),
+                                                    seeded_request.query(0)));
+  ASSERT_EQ(seeded_query.size(), full_query.size());
+  for (size_t i = 0; i < seeded_query.size(); ++i) {
+    Plaintext full_pt, seeded_pt;
+    Decryptor()->decrypt(full_query[i], full_pt);
+    Decryptor()->decrypt(seeded_query[i], seeded_pt);
+    EXPECT_EQ(seeded_pt, full_pt);
+  }
+}
+
+TEST_F(PIRClientTest, TestProcessSeededRequest) {
+  SetUpDB(84, 2);
+  SetUpServer();
+
+  client_->set_seeded_requests(true);
+  const vector<size_t> indices = {42, 5};
+  ASSIGN_OR_FAIL(auto request, client_->CreateRequest(indices));
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request));
+  ASSIGN_OR_FAIL(auto result, client_->ProcessResponseInteger(response));
+  EXPECT_THAT(result, ElementsAre(int_db_[42], int_db_[5]));
+}
+
 TEST_F(PIRClientTest, TestCreateRequestD2) {
   SetUpDB(84, 2);
   const size_t desired_index = 42;
@@ -354,6 +524,37 @@ TEST_F(PIRClientTest, TestProcessResponseBatch) {
                                   values[2].substr(7616, elem_size)));
 }
 
+TEST_F(PIRClientTest, TestParallelBatch) {
+  constexpr size_t db_size = 1000;
+  constexpr size_t elem_size = 64;
+  SetUpDB(db_size, 2, elem_size);
+
+  auto prng =
+      seal::UniformRandomGeneratorFactory::DefaultFactory()->create({42});
+  vector<string> db(db_size, string(elem_size, 0));
+  for (auto& item : db) {
+    prng->generate(item.size(), reinterpret_cast<seal::SEAL_BYTE*>(&item[0]));
+  }
+  SetUpServer(db);
+
+  client_->set_thread_pool(std::make_shared<ThreadPool>(4));
+  vector<size_t> indexes;
+  vector<string> expected;
+  for (size_t i = 3; i < db_size; i += 37) {
+    indexes.push_back(i);
+    expected.push_back(db[i]);
+  }
+  ASSIGN_OR_FAIL(auto request, client_->CreateRequest(indexes));
+  ASSERT_EQ(request.query_size(), indexes.size());
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request));
+  ASSIGN_OR_FAIL(auto result, client_->ProcessResponse(indexes, response));
+  EXPECT_THAT(result, ElementsAreArray(expected));
+
+  auto request_or = client_->CreateRequest({1, 2, db_size + 1, 3});
+  EXPECT_THAT(request_or.status().code(),
+              Eq(private_join_and_compute::StatusCode::kInvalidArgument));
+}
+
 TEST_F(PIRClientTest, TestCreateRequest_InvalidIndex) {
   auto request_or = client_->CreateRequest({db_size_ + 1});
   ASSERT_EQ(request_or.status().code(),
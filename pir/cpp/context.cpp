@@ -15,8 +15,13 @@
 //
 #include "pir/cpp/context.h"
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+
 #include "absl/memory/memory.h"
 #include "pir/cpp/serialization.h"
+#include "pir/cpp/utils.h"
 #include "seal/seal.h"
 #include "util/canonical_errors.h"
 #include "util/status_macros.h"
@@ -24,7 +29,6 @@
 
 namespace pir {
 
-using ::private_join_and_compute::InternalError;
 using ::private_join_and_compute::InvalidArgumentError;
 using ::private_join_and_compute::StatusOr;
 using seal::EncryptionParameters;
@@ -32,24 +36,70 @@ using seal::EncryptionParameters;
 PIRContext::PIRContext(shared_ptr<PIRParameters> params,
                        const EncryptionParameters& enc_params,
                        shared_ptr<seal::SEALContext> context)
-    : parameters_(params), encryption_params_(enc_params), context_(context) {
+    : parameters_(params),
+      planner_(*params),
+      encryption_params_(enc_params),
+      context_(context) {
   encoder_ = std::make_shared<seal::IntegerEncoder>(this->context_);
   evaluator_ = std::make_shared<seal::Evaluator>(context_);
 }
 
-StatusOr<std::unique_ptr<PIRContext>> PIRContext::Create(
-    shared_ptr<PIRParameters> params) {
-  ASSIGN_OR_RETURN(auto enc_params, SEALDeserialize<EncryptionParameters>(
-                                        params->encryption_parameters()));
+namespace {
+
+// Returns the SEAL context for serialized encryption parameters. Contexts are
+// immutable and safe to use from any thread, so every PIRContext with the same
+// encryption parameters shares one, along with its NTT tables and RNS bases,
+// for as long as any of them is alive.
+StatusOr<shared_ptr<seal::SEALContext>> SharedSEALContext(
+    const string& serialized_params) {
+  static std::mutex mutex;
+  static auto* contexts =
+      new std::map<string, std::weak_ptr<seal::SEALContext>>();
 
+  std::lock_guard<std::mutex> lock(mutex);
+  if (auto it = contexts->find(serialized_params); it != contexts->end()) {
+    if (auto context = it->second.lock(); context != nullptr) {
+      return context;
+    }
+  }
+
+  ASSIGN_OR_RETURN(auto enc_params,
+                   SEALDeserialize<EncryptionParameters>(serialized_params));
+  shared_ptr<seal::SEALContext> context;
   try {
-    auto context = seal::SEALContext::Create(enc_params);
-    return absl::WrapUnique(new PIRContext(params, enc_params, context));
+    context = seal::SEALContext::Create(enc_params);
   } catch (const std::exception& e) {
     return InvalidArgumentError(e.what());
   }
 
-  return InternalError("this should never happen");
+  // Drop the entries of contexts that are no longer used by anyone.
+  for (auto it = contexts->begin(); it != contexts->end();) {
+    if (it->second.expired()) {
+      it = contexts->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  (*contexts)[serialized_params] = context;
+  return context;
+}
+
+}  // namespace
+
+StatusOr<std::unique_ptr<PIRContext>> PIRContext::Create(
+    shared_ptr<PIRParameters> params) {
+  ASSIGN_OR_RETURN(auto context,
+                   SharedSEALContext(params->encryption_parameters()));
+  return absl::WrapUnique(
+      new PIRContext(params, context->key_context_data()->parms(), context));
+}
+
+std::vector<uint32_t> PIRContext::GaloisElements() {
+  const size_t poly_modulus_degree = encryption_params_.poly_modulus_degree();
+  auto galois_elts = generate_galois_elts(poly_modulus_degree);
+  galois_elts.resize(
+      ceil_log2(std::min<size_t>(DimensionsSum(), poly_modulus_degree)));
+  return galois_elts;
 }
 
 }  // namespace pir
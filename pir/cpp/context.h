@@ -17,6 +17,7 @@
 #ifndef PIR_CONTEXT_H_
 #define PIR_CONTEXT_H_
 
+#include "pir/cpp/index_planner.h"
 #include "pir/cpp/parameters.h"
 #include "seal/seal.h"
 #include "util/statusor.h"
@@ -35,7 +36,10 @@ using seal::EncryptionParameters;
 class PIRContext {
  public:
   /**
-   * Creates a new context
+   * Creates a new context. Contexts for the same encryption parameters share a
+   * single SEALContext, so creating the server, database and clients for a set
+   * of parameters, or databases of any size with the same encryption
+   * parameters, only computes the SEAL precomputations once.
    * @param[in] params PIR parameters
    * @returns InvalidArgument if the SEAL parameter deserialization fails
    **/
@@ -53,13 +57,25 @@ class PIRContext {
    * Returns the PIR parameters protobuffer.
    **/
   shared_ptr<PIRParameters> Params() { return parameters_; }
+  /**
+   * Returns the index planner for the database layout in the parameters.
+   **/
+  const IndexPlanner& Planner() const { return planner_; }
   /**
    * Returns the dimensions sum.
    **/
-  size_t DimensionsSum() {
-    return std::accumulate(Params()->dimensions().begin(),
-                           Params()->dimensions().end(), 0);
-  }
+  size_t DimensionsSum() const { return planner_.dimensions_sum(); }
+  /**
+   * Returns the Galois elements needed to expand queries, one for each level
+   * of the expansion tree. The tree only has ceil(log2(min(dim_sum, N)))
+   * levels, so this is often fewer than log2(N) elements.
+   **/
+  std::vector<uint32_t> GaloisElements();
+  /**
+   * Returns whether relinearization keys are needed to process queries, which
+   * is only the case if the database has more than one dimension.
+   **/
+  bool NeedsRelinKeys() const { return planner_.dimensions().size() > 1; }
   /**
    * Returns the encryption parameters used to create SEAL context.
    **/
@@ -76,6 +92,7 @@ class PIRContext {
              shared_ptr<seal::SEALContext> /*seal_context*/);
 
   shared_ptr<PIRParameters> parameters_;
+  IndexPlanner planner_;
   EncryptionParameters encryption_params_;
   shared_ptr<seal::SEALContext> context_;
   shared_ptr<seal::Evaluator> evaluator_;
@@ -0,0 +1,83 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/context.h"
+
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "pir/cpp/status_asserts.h"
+
+namespace pir {
+namespace {
+
+using ::private_join_and_compute::Status;
+using ::testing::Eq;
+using ::testing::Ne;
+
+TEST(PIRContextTest, TestSharesSEALContext) {
+  auto encryption_params = GenerateEncryptionParams(4096, 16);
+  ASSIGN_OR_FAIL(auto small, CreatePIRParameters(100, 0, 1, encryption_params));
+  ASSIGN_OR_FAIL(auto large,
+                 CreatePIRParameters(10000, 64, 2, encryption_params));
+  ASSIGN_OR_FAIL(auto other, CreatePIRParameters(100, 0, 1,
+                                                 GenerateEncryptionParams()));
+
+  auto small_context_or = PIRContext::Create(small);
+  ASSERT_OK(small_context_or.status());
+  auto small_context = std::move(small_context_or.ValueOrDie());
+  auto large_context_or = PIRContext::Create(large);
+  ASSERT_OK(large_context_or.status());
+  auto large_context = std::move(large_context_or.ValueOrDie());
+  auto other_context_or = PIRContext::Create(other);
+  ASSERT_OK(other_context_or.status());
+  auto other_context = std::move(other_context_or.ValueOrDie());
+
+  // Only the encryption parameters matter, not the database layout.
+  EXPECT_THAT(large_context->SEALContext(), Eq(small_context->SEALContext()));
+  EXPECT_THAT(other_context->SEALContext(), Ne(small_context->SEALContext()));
+  EXPECT_THAT(large_context->DimensionsSum(),
+              Ne(small_context->DimensionsSum()));
+  EXPECT_THAT(large_context->EncryptionParams(), Eq(encryption_params));
+}
+
+TEST(PIRContextTest, TestCreateConcurrently) {
+  ASSIGN_OR_FAIL(auto params, CreatePIRParameters(100, 0));
+  std::vector<std::unique_ptr<PIRContext>> contexts(4);
+  std::vector<std::thread> threads;
+  for (auto& context : contexts) {
+    threads.emplace_back([&context, &params]() {
+      context = std::move(PIRContext::Create(params).ValueOrDie());
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& context : contexts) {
+    ASSERT_THAT(context, Ne(nullptr));
+    EXPECT_THAT(context->SEALContext(), Eq(contexts[0]->SEALContext()));
+  }
+}
+
+TEST(PIRContextTest, TestInvalidParameters) {
+  ASSIGN_OR_FAIL(auto params, CreatePIRParameters(100, 0));
+  params->set_encryption_parameters("not encryption parameters");
+  EXPECT_THAT(PIRContext::Create(params).status().code(),
+              Eq(private_join_and_compute::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace pir
@@ -15,12 +15,19 @@
 //
 #include "pir/cpp/database.h"
 
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
 
 #include "absl/memory/memory.h"
+#include "pir/cpp/dot_product.h"
 #include "pir/cpp/string_encoder.h"
+#include "pir/cpp/thread_pool.h"
 #include "pir/cpp/utils.h"
 #include "seal/seal.h"
+#include "seal/util/ntt.h"
 #include "util/canonical_errors.h"
 #include "util/status_macros.h"
 #include "util/statusor.h"
@@ -28,6 +35,8 @@
 namespace pir {
 
 using google::protobuf::RepeatedField;
+using private_join_and_compute::DataLossError;
+using private_join_and_compute::FailedPreconditionError;
 using private_join_and_compute::InternalError;
 using private_join_and_compute::InvalidArgumentError;
 using private_join_and_compute::StatusOr;
@@ -57,6 +66,57 @@ StatusOr<shared_ptr<PIRDatabase>> PIRDatabase::Create(
   return std::move(pir_db);
 }
 
+StatusOr<shared_ptr<PIRDatabase>> PIRDatabase::Create(
+    const ItemSource& source, shared_ptr<PIRParameters> params) {
+  ASSIGN_OR_RETURN(auto context, PIRContext::Create(params));
+  auto pir_db = std::make_shared<PIRDatabase>(std::move(context));
+  RETURN_IF_ERROR(pir_db->populate(source));
+  return std::move(pir_db);
+}
+
+StatusOr<shared_ptr<PIRDatabase>> PIRDatabase::Create(
+    std::istream& records, shared_ptr<PIRParameters> params) {
+  ASSIGN_OR_RETURN(auto context, PIRContext::Create(params));
+  auto pir_db = std::make_shared<PIRDatabase>(std::move(context));
+  RETURN_IF_ERROR(pir_db->populate(records));
+  return std::move(pir_db);
+}
+
+StatusOr<shared_ptr<PIRDatabase>> PIRDatabase::Open(const string& path) {
+  ASSIGN_OR_RETURN(auto snapshot, DatabaseSnapshot::Open(path));
+  auto params = std::make_shared<PIRParameters>(snapshot->params());
+  ASSIGN_OR_RETURN(auto context, PIRContext::Create(params));
+  auto pir_db = std::make_shared<PIRDatabase>(std::move(context));
+  if (snapshot->size() != params->num_pt() ||
+      snapshot->slot_words() != pir_db->snapshot_slot_words()) {
+    return DataLossError("Snapshot " + path + " does not match its parameters");
+  }
+  pir_db->snapshot_ = std::move(snapshot);
+  return std::move(pir_db);
+}
+
+Status PIRDatabase::Save(const string& path) const {
+  std::shared_lock<std::shared_mutex> lock(plaintexts_mutex_);
+  return DatabaseSnapshot::Write(
+      path, *context_->Params(), size(), snapshot_slot_words(),
+      [this](size_t i, size_t* count) {
+        if (snapshot_ != nullptr) {
+          *count = snapshot_->slot_words();
+          return snapshot_->plaintext(i);
+        }
+        *count = db_[i].coeff_count();
+        return static_cast<const uint64_t*>(db_[i].data());
+      });
+}
+
+size_t PIRDatabase::snapshot_slot_words() const {
+  const auto& parms = context_->SEALContext()->first_context_data()->parms();
+  if (!context_->Params()->preprocess_ntt()) {
+    return parms.poly_modulus_degree();
+  }
+  return parms.poly_modulus_degree() * parms.coeff_modulus().size();
+}
+
 Status PIRDatabase::populate(const vector<std::int64_t>& rawdb) {
   if (rawdb.size() != context_->Params()->num_items()) {
     return InvalidArgumentError(
@@ -65,6 +125,7 @@ Status PIRDatabase::populate(const vector<std::int64_t>& rawdb) {
         std::to_string(context_->Params()->num_items()));
   }
 
+  snapshot_.reset();
   db_.resize(rawdb.size());
   for (size_t idx = 0; idx < rawdb.size(); ++idx) {
     try {
@@ -72,6 +133,7 @@ Status PIRDatabase::populate(const vector<std::int64_t>& rawdb) {
     } catch (std::exception& e) {
       return InvalidArgumentError(e.what());
     }
+    RETURN_IF_ERROR(preprocess(db_[idx]));
   }
   return Status::OK;
 }
@@ -83,136 +145,615 @@ Status PIRDatabase::populate(const vector<string>& rawdb) {
         " does not match params value " +
         std::to_string(context_->Params()->num_items()));
   }
+  return populate([&rawdb](size_t index, string* item) {
+    *item = rawdb[index];
+    return Status::OK;
+  });
+}
 
-  const auto items_per_pt = context_->Params()->items_per_plaintext();
+Status PIRDatabase::populate(const ItemSource& source) {
+  const size_t num_items = context_->Params()->num_items();
+  const size_t items_per_pt = context_->Params()->items_per_plaintext();
+  snapshot_.reset();
   db_.resize(context_->Params()->num_pt());
   auto encoder = std::make_unique<StringEncoder>(context_->SEALContext());
   if (context_->Params()->bits_per_coeff() > 0) {
     encoder->set_bits_per_coeff(context_->Params()->bits_per_coeff());
   }
-  auto raw_it = rawdb.begin();
+
+  // Items for one plaintext at a time. Strings are reused so that their
+  // buffers are only allocated once.
+  vector<string> items(items_per_pt);
+  size_t index = 0;
   for (size_t i = 0; i < db_.size(); ++i) {
-    auto end_it = std::min(raw_it + items_per_pt, rawdb.end());
-    RETURN_IF_ERROR(encoder->encode(raw_it, end_it, db_[i]));
-    raw_it += items_per_pt;
+    const size_t count = std::min(items_per_pt, num_items - index);
+    for (size_t j = 0; j < count; ++j) {
+      RETURN_IF_ERROR(source(index++, &items[j]));
+    }
+    RETURN_IF_ERROR(encoder->encode(items.cbegin(), items.cbegin() + count,
+                                    db_[i]));
+    RETURN_IF_ERROR(preprocess(db_[i]));
+  }
+  return Status::OK;
+}
+
+Status PIRDatabase::populate(std::istream& records) {
+  const size_t item_size = context_->Params()->bytes_per_item();
+  return populate([&records, item_size](size_t index, string* item) {
+    item->resize(item_size);
+    if (!records.read(&(*item)[0], item_size)) {
+      return InvalidArgumentError("Unable to read database item " +
+                                  std::to_string(index));
+    }
+    return Status::OK;
+  });
+}
+
+Status PIRDatabase::update(uint32_t index, const string& value) {
+  return update({{index, value}});
+}
+
+Status PIRDatabase::update(
+    const vector<std::pair<uint32_t, string>>& updates) {
+  const size_t num_items = context_->Params()->num_items();
+  const size_t items_per_pt = context_->Params()->items_per_plaintext();
+  const size_t item_size = context_->Params()->bytes_per_item();
+  for (const auto& entry : updates) {
+    if (entry.first >= num_items) {
+      return InvalidArgumentError("Item index " + std::to_string(entry.first) +
+                                  " is out of range");
+    }
+    if (entry.second.size() != item_size) {
+      return InvalidArgumentError(
+          "Item size " + std::to_string(entry.second.size()) +
+          " does not match params value " + std::to_string(item_size));
+    }
+  }
+
+  // Group the updates by plaintext, keeping their order within each group so
+  // that later values for the same index win.
+  vector<size_t> order(updates.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return updates[a].first / items_per_pt < updates[b].first / items_per_pt;
+  });
+
+  StringEncoder encoder(context_->SEALContext());
+  if (context_->Params()->bits_per_coeff() > 0) {
+    encoder.set_bits_per_coeff(context_->Params()->bits_per_coeff());
+  }
+  // Every affected plaintext is encoded before any of them is written, so
+  // that a failure leaves the database unchanged.
+  vector<std::pair<size_t, Plaintext>> encoded;
+  vector<string> items;
+  std::unique_lock<std::shared_mutex> lock(plaintexts_mutex_);
+  for (size_t u = 0; u < order.size();) {
+    const size_t pt_index = updates[order[u]].first / items_per_pt;
+    const size_t first_item = pt_index * items_per_pt;
+    const size_t count = std::min(items_per_pt, num_items - first_item);
+
+    Plaintext pt;
+    RETURN_IF_ERROR(get_coefficients(pt_index, pt));
+    items.resize(count);
+    for (size_t j = 0; j < count; ++j) {
+      const size_t offset = calculate_item_offset(first_item + j);
+      ASSIGN_OR_RETURN(items[j], encoder.decode(pt, item_size, offset));
+    }
+    for (; u < order.size() &&
+           updates[order[u]].first / items_per_pt == pt_index;
+         ++u) {
+      items[updates[order[u]].first - first_item] = updates[order[u]].second;
+    }
+
+    RETURN_IF_ERROR(encoder.encode(items.cbegin(), items.cend(), pt));
+    RETURN_IF_ERROR(preprocess(pt));
+    encoded.emplace_back(pt_index, std::move(pt));
+  }
+
+  for (auto& entry : encoded) {
+    const Plaintext& pt = entry.second;
+    if (snapshot_ != nullptr) {
+      uint64_t* slot = snapshot_->mutable_plaintext(entry.first);
+      std::copy_n(pt.data(), pt.coeff_count(), slot);
+      std::fill(slot + pt.coeff_count(), slot + snapshot_->slot_words(), 0);
+    } else {
+      db_[entry.first] = std::move(entry.second);
+    }
+  }
+  return Status::OK;
+}
+
+Status PIRDatabase::get_coefficients(size_t i, Plaintext& destination) const {
+  const uint64_t* data =
+      snapshot_ != nullptr ? snapshot_->plaintext(i) : db_[i].data();
+  if (!context_->Params()->preprocess_ntt()) {
+    if (snapshot_ == nullptr) {
+      destination = db_[i];
+    } else {
+      destination.resize(snapshot_->slot_words());
+      std::copy_n(data, snapshot_->slot_words(), destination.data());
+    }
+    return Status::OK;
+  }
+
+  // Plaintexts are lifted to the coefficient modulus before the NTT, mapping
+  // values c >= (t + 1) / 2 to c + q - t. The first RNS limb is enough to
+  // undo this as long as t is smaller than each of the coefficient moduli.
+  auto context_data = context_->SEALContext()->first_context_data();
+  if (!context_data->qualifiers().using_fast_plain_lift) {
+    return FailedPreconditionError(
+        "Can't recover NTT form plaintexts unless the plain modulus is smaller "
+        "than the coefficient moduli");
+  }
+  const auto& parms = context_data->parms();
+  const size_t n = parms.poly_modulus_degree();
+  const uint64_t plain_modulus = parms.plain_modulus().value();
+  const uint64_t modulus = parms.coeff_modulus()[0].value();
+  const uint64_t threshold = context_data->plain_upper_half_threshold();
+
+  destination.parms_id() = seal::parms_id_zero;
+  destination.resize(n);
+  std::copy_n(data, n, destination.data());
+  seal::util::inverse_ntt_negacyclic_harvey(
+      destination.data(), context_data->small_ntt_tables()[0]);
+  for (size_t j = 0; j < n; ++j) {
+    if (destination[j] >= threshold) {
+      destination[j] = destination[j] + plain_modulus - modulus;
+    }
   }
   return Status::OK;
 }
 
+Status PIRDatabase::preprocess(Plaintext& pt) {
+  if (!context_->Params()->preprocess_ntt()) {
+    return Status::OK;
+  }
+  try {
+    context_->Evaluator()->transform_to_ntt_inplace(
+        pt, context_->SEALContext()->first_parms_id());
+  } catch (std::exception& e) {
+    return InternalError(e.what());
+  }
+  return Status::OK;
+}
+
+/**
+ * Read-only access to the database plaintexts, whether they are held in memory
+ * or mapped from a snapshot.
+ */
+class PlaintextView {
+ public:
+  PlaintextView(const vector<Plaintext>& plaintexts,
+                const DatabaseSnapshot* snapshot)
+      : plaintexts_(plaintexts), snapshot_(snapshot) {}
+
+  size_t size() const {
+    return snapshot_ != nullptr ? snapshot_->size() : plaintexts_.size();
+  }
+
+  /**
+   * Coefficients of plaintext i.
+   */
+  const uint64_t* data(size_t i) const {
+    return snapshot_ != nullptr ? snapshot_->plaintext(i)
+                                : plaintexts_[i].data();
+  }
+
+  /**
+   * Plaintext i in coefficient form, for use with the evaluator. Plaintexts
+   * from a snapshot are copied into scratch first.
+   */
+  const Plaintext& get(size_t i, Plaintext& scratch) const {
+    if (snapshot_ == nullptr) {
+      return plaintexts_[i];
+    }
+    scratch.resize(snapshot_->slot_words());
+    std::copy_n(snapshot_->plaintext(i), snapshot_->slot_words(),
+                scratch.data());
+    return scratch;
+  }
+
+ private:
+  const vector<Plaintext>& plaintexts_;
+  const DatabaseSnapshot* snapshot_;
+};
+
+// Creates ciphertexts that allocate from the given memory pool. Copies of a
+// ciphertext allocate from the global pool, so they can't be made by copying.
+vector<Ciphertext> MakeCiphertexts(size_t count, seal::MemoryPoolHandle pool) {
+  vector<Ciphertext> cts;
+  cts.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    cts.emplace_back(pool);
+  }
+  return cts;
+}
+
 /**
- * Helper class to make the recursive multiplication operation on the
- * multi-dimensional representation of the database easier. Encapsulates all of
- * the variables needed to do the multiplication, and keeps track of the
- * database iterator to separate it from the database itself.
+ * Helper class to fold the multi-dimensional representation of the database
+ * with one or more selection vectors. Encapsulates all of the variables needed
+ * to do the multiplication.
+ *
+ * The hypercube is walked iteratively, like an odometer over the indices of
+ * all but the last dimension. Each step does a dot product of the last
+ * dimension's selection vector with one row of the database, and folds the
+ * result up into the accumulators of the dimensions above, once all of their
+ * indices have been visited. Positions in the database are computed from
+ * precomputed strides, so independent ranges of the first dimension can be
+ * folded on different threads. All ciphertexts used along the way live in a
+ * workspace allocated once per range, so the loop itself doesn't allocate.
+ *
+ * Several selection vectors can be multiplied at once. Each database plaintext
+ * is then read once and used for all of them while it is still in cache,
+ * rather than streaming the whole database once per selection vector.
  */
 class DatabaseMultiplier {
  public:
   /**
    * Create a multiplier for the given scenario.
    * @param[in] database Database against which to multiply.
-   * @param[in] selection_vector multi-dimensional selection vector
+   * @param[in] selection_vectors multi-dimensional selection vectors, one per
+   *    query.
+   * @param[in] seal_context SEAL context of the database and selection vector.
    * @param[in] evaluator Evaluator to use for homomorphic operations.
    * @param[in] relin_keys If not nullptr, relinearization will be done after
    *    every homomorphic multiplication.
    * @param[in] decryptor If not nullptr, outputs to cout the noise budget
    *    remaining after every homomorphic operation.
+   * @param[in] ntt_form If true, database plaintexts are assumed to be in NTT
+   *    form already.
+   * @param[in] thread_pool If not nullptr, work is split across threads of
+   *    the pool.
+   * @param[in] memory_pool Memory pool to allocate ciphertexts from.
    */
-  DatabaseMultiplier(const vector<Plaintext>& database,
-                     const vector<Ciphertext>& selection_vector,
+  DatabaseMultiplier(const PlaintextView& database,
+                     const vector<const vector<Ciphertext>*>& selection_vectors,
+                     shared_ptr<seal::SEALContext> seal_context,
                      shared_ptr<Evaluator> evaluator,
                      const seal::RelinKeys* const relin_keys,
-                     seal::Decryptor* const decryptor)
+                     seal::Decryptor* const decryptor, bool ntt_form,
+                     ThreadPool* thread_pool,
+                     seal::MemoryPoolHandle memory_pool)
       : database_(database),
-        selection_vector_(selection_vector),
+        selection_vectors_(selection_vectors),
+        seal_context_(seal_context),
         evaluator_(evaluator),
         relin_keys_(relin_keys),
-        decryptor_(decryptor) {}
+        decryptor_(decryptor),
+        ntt_form_(ntt_form),
+        thread_pool_(thread_pool),
+        memory_pool_(memory_pool) {
+    // A tile is worked on one slice of coefficients at a time. For each query
+    // a slice touches the query's accumulator lanes, and the plaintext and
+    // the query's selection ciphertext of each row, which all have to fit
+    // together for the plaintexts to still be cached for the next query.
+    const auto& parms = seal_context_->first_context_data()->parms();
+    poly_modulus_degree_ = parms.poly_modulus_degree();
+    coeffs_per_slice_ = std::min<size_t>(kSliceCoeffs, poly_modulus_degree_);
+    const size_t slice_words = coeffs_per_slice_ * parms.coeff_modulus().size();
+    const size_t lane_bytes =
+        kSelectionSize * slice_words * sizeof(unsigned __int128);
+    const size_t row_bytes =
+        (kSelectionSize + 1) * slice_words * sizeof(uint64_t);
+    rows_per_tile_ = std::max<size_t>(
+        1, kTileBytes > lane_bytes ? (kTileBytes - lane_bytes) / row_bytes : 0);
+    if (ntt_form_) {
+      rows_per_tile_ = std::min(
+          rows_per_tile_, DotProductAccumulator(seal_context_).max_pending());
+    }
+  }
 
   /**
-   * Do the multiplication using the given dimension sizes.
+   * Do the multiplication using the given dimension sizes. The first dimension
+   * is split into contiguous ranges, one per thread, each producing a partial
+   * result. The partial results are added together at the end.
+   * @returns One result per selection vector.
    */
-  Ciphertext multiply(const RepeatedField<uint32_t>& dimensions) {
-    database_it_ = database_.begin();
-    return multiply(dimensions, selection_vector_.begin(), 0);
+  StatusOr<vector<Ciphertext>> multiply(
+      const RepeatedField<uint32_t>& dimensions) {
+    const size_t num_queries = selection_vectors_.size();
+    dimensions_.assign(dimensions.begin(), dimensions.end());
+    const size_t num_dimensions = dimensions_.size();
+
+    // Number of database plaintexts covered by one index at each depth, and
+    // where each depth's part of the selection vector starts.
+    block_sizes_.assign(num_dimensions, 1);
+    selection_offsets_.assign(num_dimensions, 0);
+    for (size_t d = num_dimensions - 1; d > 0; --d) {
+      block_sizes_[d - 1] = block_sizes_[d] * dimensions_[d];
+    }
+    for (size_t d = 1; d < num_dimensions; ++d) {
+      selection_offsets_[d] = selection_offsets_[d - 1] + dimensions_[d - 1];
+    }
+
+    if (ntt_form_) {
+      // Only the last dimension is multiplied against the database, so only
+      // that part of the selection vector has to be transformed. Done once
+      // here, since each of them is used for every row of the database.
+      const size_t last_dimension = dimensions_.back();
+      const size_t depth = num_dimensions - 1;
+      ntt_selection_vectors_.resize(num_queries);
+      for (auto& ntt_selection_vector : ntt_selection_vectors_) {
+        ntt_selection_vector = MakeCiphertexts(last_dimension, memory_pool_);
+      }
+      RETURN_IF_ERROR(ParallelFor(
+          thread_pool_, num_queries * last_dimension, [&](size_t n) {
+            const size_t q = n / last_dimension;
+            const size_t i = n % last_dimension;
+            evaluator_->transform_to_ntt(selection(q, depth, i),
+                                         ntt_selection_vectors_[q][i]);
+            return Status::OK;
+          }));
+    }
+
+    // Don't hand out ranges of the first dimension that are past the end of
+    // the database.
+    const size_t first_dimension = std::min<size_t>(
+        dimensions_[0],
+        (database_.size() + block_sizes_[0] - 1) / block_sizes_[0]);
+    if (first_dimension == 0) {
+      return InvalidArgumentError("Database is empty");
+    }
+    size_t num_chunks = 1;
+    if (thread_pool_ != nullptr) {
+      num_chunks = std::min(first_dimension, thread_pool_->num_threads() + 1);
+    }
+    vector<vector<Ciphertext>> partial_results(num_chunks);
+    RETURN_IF_ERROR(ParallelFor(thread_pool_, num_chunks, [&](size_t chunk) {
+      Workspace workspace(num_dimensions, num_queries, seal_context_,
+                          memory_pool_);
+      const size_t begin = first_dimension * chunk / num_chunks;
+      const size_t end = first_dimension * (chunk + 1) / num_chunks;
+      fold(begin, end, workspace);
+      partial_results[chunk] = std::move(workspace.results());
+      return Status::OK;
+    }));
+
+    vector<Ciphertext>& results = partial_results[0];
+    RETURN_IF_ERROR(ParallelFor(thread_pool_, num_queries, [&](size_t q) {
+      for (size_t chunk = 1; chunk < num_chunks; ++chunk) {
+        evaluator_->add_inplace(results[q], partial_results[chunk][q]);
+      }
+      if (results[q].is_ntt_form()) {
+        evaluator_->transform_from_ntt_inplace(results[q]);
+      }
+      print_noise(0, "final", results[q]);
+      return Status::OK;
+    }));
+    return std::move(results);
   }
 
  private:
+  // Working set of one query for a slice of a tile of database rows, which
+  // should stay in a per-core L2 cache. See the constructor.
+  static constexpr size_t kTileBytes = 256 * 1024;
+
+  // Number of coefficients of each polynomial in a slice.
+  static constexpr size_t kSliceCoeffs = 512;
+
+  // Number of polynomials in a selection vector ciphertext.
+  static constexpr size_t kSelectionSize = 2;
+
   /**
-   * Recursive function to do the dot product of each dimension with the db.
-   * Calls itself to move down dimensions until you get to the bottom dimension.
-   * Bottom dimension just does a dot product with the DB, and returns the
-   * result. Upper levels then take those results, and dot product again with
-   * the selection vector, until you get back to the top. NB: Database iterator
-   * is kept at the class level so that we move through the database one element
-   * at a time.
-   *
-   * @param[in] dimensions List of remaining demainsion sizes.
-   * @param[in] selection_vector_it Iterator into the start of the selection
-   *  vector for the current depth.
-   * @param[in] depth Current depth.
+   * Scratch space for folding one range of the first dimension. Buffers are
+   * swapped between depths rather than copied, and SEAL reuses the capacity of
+   * a ciphertext when it is overwritten, so once every buffer has been used
+   * once nothing is allocated any more.
    */
-  Ciphertext multiply(const RepeatedField<uint32_t>& dimensions,
-                      vector<Ciphertext>::const_iterator selection_vector_it,
-                      size_t depth) {
-    const size_t this_dimension = dimensions[0];
-    auto remaining_dimensions =
-        RepeatedField<uint32_t>(dimensions.begin() + 1, dimensions.end());
-
-    string depth_string(depth, ' ');
-
-    Ciphertext result;
-    bool first_pass = true;
-    for (size_t i = 0; i < this_dimension; ++i) {
-      // make sure we don't go past end of DB
-      if (database_it_ == database_.end()) break;
-      Ciphertext temp_ct;
-      if (remaining_dimensions.empty()) {
-        // base case: have to multiply against DB
-        evaluator_->multiply_plain(*(selection_vector_it + i),
-                                   *(database_it_++), temp_ct);
-        print_noise(depth, "base", temp_ct, i);
+  class Workspace {
+   public:
+    Workspace(size_t num_dimensions, size_t num_queries,
+              shared_ptr<seal::SEALContext> seal_context,
+              seal::MemoryPoolHandle memory_pool)
+        : indices(num_dimensions, 0),
+          has_value(num_dimensions, false),
+          row(MakeCiphertexts(num_queries, memory_pool)),
+          term(MakeCiphertexts(num_queries, memory_pool)),
+          scratch(memory_pool) {
+      dot_products.reserve(num_queries);
+      for (size_t q = 0; q < num_queries; ++q) {
+        dot_products.emplace_back(seal_context, memory_pool);
+      }
+      for (size_t d = 0; d < num_dimensions; ++d) {
+        accumulated.push_back(MakeCiphertexts(num_queries, memory_pool));
+      }
+    }
 
-      } else {
-        temp_ct = multiply(remaining_dimensions,
-                           selection_vector_it + this_dimension, depth + 1);
-        print_noise(depth, "recurse", temp_ct, i);
+    // Final results of the fold, for each query.
+    vector<Ciphertext>& results() { return accumulated[0]; }
+
+    // Current index at each depth above the last one.
+    vector<size_t> indices;
+
+    // Sum of the terms folded so far at each depth, for each query.
+    vector<vector<Ciphertext>> accumulated;
+    vector<bool> has_value;
+
+    // Dot product of the current database row, for each query.
+    vector<Ciphertext> row;
+
+    // Single term of a dot product, for each query.
+    vector<Ciphertext> term;
+
+    // Lazily reduced dot products, used if the database is in NTT form.
+    vector<DotProductAccumulator> dot_products;
+
+    // Holds plaintexts copied out of a snapshot.
+    Plaintext scratch;
+  };
+
+  /**
+   * Part of the selection vector of query q for index i of the given depth.
+   */
+  const Ciphertext& selection(size_t q, size_t depth, size_t i) const {
+    return (*selection_vectors_[q])[selection_offsets_[depth] + i];
+  }
 
-        evaluator_->multiply_inplace(temp_ct, *(selection_vector_it + i));
-        print_noise(depth, "mult", temp_ct, i);
+  /**
+   * Folds indices [begin, end) of the first dimension, leaving the results in
+   * workspace.results().
+   */
+  void fold(size_t begin, size_t end, Workspace& ws) {
+    const size_t num_dimensions = dimensions_.size();
+    const size_t num_queries = selection_vectors_.size();
+    const size_t last = num_dimensions - 1;
+
+    if (num_dimensions == 1) {
+      // The first dimension is the last, so its dot product is the result.
+      dot_product(begin, end, 0, ws);
+      for (size_t q = 0; q < num_queries; ++q) {
+        std::swap(ws.accumulated[0][q], ws.row[q]);
+      }
+      return;
+    }
 
-        if (relin_keys_ != nullptr) {
-          evaluator_->relinearize_inplace(temp_ct, *relin_keys_);
-          print_noise(depth, "relin", temp_ct, i);
+    auto& indices = ws.indices;
+    std::fill(indices.begin(), indices.end(), 0);
+    indices[0] = begin;
+    size_t db_offset = begin * block_sizes_[0];
+    while (true) {
+      // Dot product of one row with the last dimension of the selection
+      // vector, multiplied by the selection vector of the depth above.
+      dot_product(0, dimensions_[last], db_offset, ws);
+      fold_into(last - 1, ws.row, ws);
+
+      // Move on to the next row, folding up each depth that is finished.
+      size_t depth = last - 1;
+      while (true) {
+        ++indices[depth];
+        db_offset += block_sizes_[depth];
+        const size_t limit = depth == 0 ? end : dimensions_[depth];
+        if (indices[depth] < limit && db_offset < database_.size()) {
+          break;
         }
+        if (depth == 0) {
+          return;
+        }
+        db_offset -= indices[depth] * block_sizes_[depth];
+        indices[depth] = 0;
+        ws.has_value[depth] = false;
+        fold_into(depth - 1, ws.accumulated[depth], ws);
+        --depth;
       }
+    }
+  }
 
-      if (first_pass) {
-        result = temp_ct;
-        first_pass = false;
+  /**
+   * Multiplies the given ciphertexts by the selection vector at depth, for the
+   * current index, and adds the products to the sums of that depth. The
+   * ciphertexts are used as scratch space.
+   */
+  void fold_into(size_t depth, vector<Ciphertext>& cts, Workspace& ws) {
+    const size_t i = ws.indices[depth];
+    for (size_t q = 0; q < cts.size(); ++q) {
+      auto& ct = cts[q];
+      // Multiplying ciphertexts together can't be done in NTT form
+      if (ct.is_ntt_form()) {
+        evaluator_->transform_from_ntt_inplace(ct);
+      }
+      print_noise(depth, "recurse", ct, i);
+
+      evaluator_->multiply_inplace(ct, selection(q, depth, i), memory_pool_);
+      print_noise(depth, "mult", ct, i);
+
+      if (relin_keys_ != nullptr) {
+        evaluator_->relinearize_inplace(ct, *relin_keys_, memory_pool_);
+        print_noise(depth, "relin", ct, i);
+      }
+
+      if (!ws.has_value[depth]) {
+        std::swap(ws.accumulated[depth][q], ct);
       } else {
-        evaluator_->add_inplace(result, temp_ct);
-        print_noise(depth, "result", temp_ct, i);
+        evaluator_->add_inplace(ws.accumulated[depth][q], ct);
+        print_noise(depth, "result", ws.accumulated[depth][q], i);
       }
     }
+    ws.has_value[depth] = true;
+  }
 
-    print_noise(depth, "final", result);
-    return result;
+  /**
+   * Dot product of indices [begin, end) of the last dimension of the selection
+   * vectors with the database plaintexts starting at db_offset, stopping at
+   * the end of the database. Results are left in ws.row.
+   *
+   * If the database is in NTT form, products are accumulated without reducing
+   * after every term, and the results are left in NTT form. Rows are taken a
+   * tile at a time, and each slice of coefficients of a tile is run through
+   * every selection vector before moving on, so that the database is only
+   * read from memory once.
+   */
+  void dot_product(size_t begin, size_t end, size_t db_offset, Workspace& ws) {
+    const size_t num_queries = selection_vectors_.size();
+    const size_t depth = dimensions_.size() - 1;
+    // make sure we don't go past end of DB
+    end = std::min(end, database_.size() - db_offset);
+
+    if (ntt_form_) {
+      for (size_t tile = begin; tile < end; tile += rows_per_tile_) {
+        const size_t tile_end = std::min(end, tile + rows_per_tile_);
+        for (size_t q = 0; q < num_queries; ++q) {
+          ws.dot_products[q].reserve_terms(tile_end - tile);
+        }
+        for (size_t c = 0; c < poly_modulus_degree_; c += coeffs_per_slice_) {
+          const size_t c_end =
+              std::min(poly_modulus_degree_, c + coeffs_per_slice_);
+          for (size_t q = 0; q < num_queries; ++q) {
+            for (size_t i = tile; i < tile_end; ++i) {
+              ws.dot_products[q].multiply_add(ntt_selection_vectors_[q][i],
+                                              database_.data(db_offset + i),
+                                              c, c_end);
+            }
+          }
+        }
+      }
+      for (size_t q = 0; q < num_queries; ++q) {
+        ws.dot_products[q].get_result(ws.row[q]);
+        ws.dot_products[q].reset();
+        print_noise(depth, "base", ws.row[q]);
+      }
+      return;
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+      const Plaintext& pt = database_.get(db_offset + i, ws.scratch);
+      for (size_t q = 0; q < num_queries; ++q) {
+        if (i == begin) {
+          evaluator_->multiply_plain(selection(q, depth, i), pt, ws.row[q],
+                                     memory_pool_);
+          print_noise(depth, "base", ws.row[q], i);
+        } else {
+          evaluator_->multiply_plain(selection(q, depth, i), pt, ws.term[q],
+                                     memory_pool_);
+          print_noise(depth, "base", ws.term[q], i);
+          evaluator_->add_inplace(ws.row[q], ws.term[q]);
+        }
+      }
+    }
   }
 
   void print_noise(size_t depth, const string& desc, const Ciphertext& ct,
                    std::optional<size_t> i_opt = {}) {
     if (decryptor_ != nullptr) {
+      int noise_budget;
+      if (ct.is_ntt_form()) {
+        Ciphertext temp_ct;
+        evaluator_->transform_from_ntt(ct, temp_ct);
+        noise_budget = decryptor_->invariant_noise_budget(temp_ct);
+      } else {
+        noise_budget = decryptor_->invariant_noise_budget(ct);
+      }
+      std::lock_guard<std::mutex> lock(print_mutex_);
       std::cout << string(depth, ' ');
       if (i_opt) {
         std::cout << "i = " << (*i_opt) << " ";
       }
-      std::cout << desc << " noise budget "
-                << decryptor_->invariant_noise_budget(ct) << std::endl;
+      std::cout << desc << " noise budget " << noise_budget << std::endl;
     }
   }
 
-  const vector<Plaintext>& database_;
-  const vector<Ciphertext>& selection_vector_;
+  const PlaintextView& database_;
+  const vector<const vector<Ciphertext>*>& selection_vectors_;
+  shared_ptr<seal::SEALContext> seal_context_;
   shared_ptr<Evaluator> evaluator_;
 
   // If not null, relinearization keys are applied after each HE op
@@ -220,47 +761,159 @@ class DatabaseMultiplier {
 
   // If not null, used to get invariant noise budget after each HE op
   seal::Decryptor* const decryptor_;
+  std::mutex print_mutex_;
+
+  // True if database plaintexts are already in NTT form
+  const bool ntt_form_;
+
+  // If not null, used to multiply parts of the first dimension in parallel
+  ThreadPool* const thread_pool_;
+
+  // Memory pool for all ciphertexts and temporaries of the multiplication
+  seal::MemoryPoolHandle memory_pool_;
+
+  // Number of database rows in each tile of the NTT base case, and number of
+  // coefficients in each slice of a tile
+  size_t rows_per_tile_;
+  size_t coeffs_per_slice_;
+  size_t poly_modulus_degree_;
 
-  // Current location as we move through the database.
-  // Needs to be kept here, as lower levels of recursion move forward.
-  vector<Plaintext>::const_iterator database_it_;
+  // Size of each dimension
+  vector<size_t> dimensions_;
+
+  // Number of database plaintexts covered by one index at each depth
+  vector<size_t> block_sizes_;
+
+  // Offset of each depth's part of the selection vector
+  vector<size_t> selection_offsets_;
+
+  // NTT form of the part of each selection vector multiplied against the
+  // database. Only used if ntt_form_ is set.
+  vector<vector<Ciphertext>> ntt_selection_vectors_;
 };
 
 StatusOr<Ciphertext> PIRDatabase::multiply(
     const vector<Ciphertext>& selection_vector,
-    const seal::RelinKeys* const relin_keys,
-    seal::Decryptor* const decryptor) const {
+    const seal::RelinKeys* const relin_keys, seal::Decryptor* const decryptor,
+    seal::MemoryPoolHandle pool) const {
+  const vector<const vector<Ciphertext>*> selection_vectors = {
+      &selection_vector};
+  ASSIGN_OR_RETURN(auto results,
+                   multiply(selection_vectors, relin_keys, decryptor, pool));
+  return std::move(results[0]);
+}
+
+StatusOr<vector<Ciphertext>> PIRDatabase::multiply(
+    const vector<vector<Ciphertext>>& selection_vectors,
+    const seal::RelinKeys* const relin_keys, seal::Decryptor* const decryptor,
+    seal::MemoryPoolHandle pool) const {
+  vector<const vector<Ciphertext>*> pointers;
+  pointers.reserve(selection_vectors.size());
+  for (const auto& selection_vector : selection_vectors) {
+    pointers.push_back(&selection_vector);
+  }
+  return multiply(pointers, relin_keys, decryptor, pool);
+}
+
+StatusOr<vector<Ciphertext>> PIRDatabase::multiply(
+    const vector<const vector<Ciphertext>*>& selection_vectors,
+    const seal::RelinKeys* const relin_keys, seal::Decryptor* const decryptor,
+    seal::MemoryPoolHandle pool) const {
   auto& dimensions = context_->Params()->dimensions();
   const size_t dim_sum = context_->DimensionsSum();
 
-  if (selection_vector.size() != dim_sum) {
-    return InvalidArgumentError(
-        "Selection vector size does not match dimensions");
+  if (selection_vectors.empty()) {
+    return vector<Ciphertext>();
+  }
+  for (const auto* selection_vector : selection_vectors) {
+    if (selection_vector->size() != dim_sum) {
+      return InvalidArgumentError(
+          "Selection vector size does not match dimensions");
+    }
   }
 
   try {
-    DatabaseMultiplier dbm(db_, selection_vector, context_->Evaluator(),
-                           relin_keys, decryptor);
+    std::shared_lock<std::shared_mutex> lock(plaintexts_mutex_);
+    PlaintextView database(db_, snapshot_.get());
+    DatabaseMultiplier dbm(database, selection_vectors, context_->SEALContext(),
+                           context_->Evaluator(), relin_keys, decryptor,
+                           context_->Params()->preprocess_ntt(),
+                           thread_pool_.get(), pool);
     return dbm.multiply(dimensions);
   } catch (std::exception& e) {
     return InternalError(e.what());
   }
 }
 
-vector<uint32_t> PIRDatabase::calculate_indices(uint32_t index) {
-  uint32_t pt_index = index / context_->Params()->items_per_plaintext();
-  vector<uint32_t> results(context_->Params()->dimensions_size(), 0);
-  for (int i = results.size() - 1; i >= 0; --i) {
-    results[i] = pt_index % context_->Params()->dimensions(i);
-    pt_index = pt_index / context_->Params()->dimensions(i);
+StatusOr<std::unique_ptr<PIRDatabase::SelectionAccumulator>>
+PIRDatabase::accumulate(seal::MemoryPoolHandle pool) const {
+  if (context_->Params()->dimensions_size() != 1) {
+    return FailedPreconditionError(
+        "Streaming multiplication needs a one-dimensional database");
   }
-  return results;
+  return absl::WrapUnique(new SelectionAccumulator(*this, pool));
+}
+
+PIRDatabase::SelectionAccumulator::SelectionAccumulator(
+    const PIRDatabase& database, seal::MemoryPoolHandle pool)
+    : database_(database),
+      pool_(pool),
+      dot_product_(database.context_->SEALContext(), pool),
+      ntt_selection_(pool),
+      term_(pool),
+      result_(pool),
+      scratch_(pool) {}
+
+Status PIRDatabase::SelectionAccumulator::add(size_t index,
+                                              const Ciphertext& selection) {
+  if (index >= database_.size()) {
+    return Status::OK;
+  }
+  std::shared_lock<std::shared_mutex> lock(database_.plaintexts_mutex_);
+  const PlaintextView plaintexts(database_.db_, database_.snapshot_.get());
+  auto evaluator = database_.context_->Evaluator();
+  try {
+    if (database_.context_->Params()->preprocess_ntt()) {
+      evaluator->transform_to_ntt(selection, ntt_selection_);
+      dot_product_.multiply_add(ntt_selection_, plaintexts.data(index));
+    } else {
+      evaluator->multiply_plain(selection, plaintexts.get(index, scratch_),
+                                term_, pool_);
+      if (has_value_) {
+        evaluator->add_inplace(result_, term_);
+      } else {
+        std::swap(result_, term_);
+      }
+    }
+  } catch (const std::exception& e) {
+    return InternalError(e.what());
+  }
+  has_value_ = true;
+  return Status::OK;
+}
+
+StatusOr<Ciphertext> PIRDatabase::SelectionAccumulator::result() {
+  if (!has_value_) {
+    return FailedPreconditionError("No selection vector ciphertexts added");
+  }
+  try {
+    if (database_.context_->Params()->preprocess_ntt()) {
+      dot_product_.get_result(result_);
+      dot_product_.reset();
+      database_.context_->Evaluator()->transform_from_ntt_inplace(result_);
+    }
+  } catch (const std::exception& e) {
+    return InternalError(e.what());
+  }
+  return std::move(result_);
+}
+
+vector<uint32_t> PIRDatabase::calculate_indices(uint32_t index) {
+  return context_->Planner().calculate_indices(index);
 }
 
 size_t PIRDatabase::calculate_item_offset(uint32_t index) {
-  uint32_t pt_index = index / context_->Params()->items_per_plaintext();
-  return (index - (pt_index * context_->Params()->items_per_plaintext())) *
-         context_->Params()->bytes_per_item();
+  return context_->Planner().calculate_item_offset(index);
 }
 
 vector<uint32_t> PIRDatabase::calculate_dimensions(uint32_t db_size,
@@ -17,10 +17,17 @@
 #ifndef PIR_DATABASE_H_
 #define PIR_DATABASE_H_
 
+#include <functional>
+#include <istream>
+#include <shared_mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "pir/cpp/context.h"
+#include "pir/cpp/dot_product.h"
+#include "pir/cpp/snapshot.h"
+#include "pir/cpp/thread_pool.h"
 #include "seal/seal.h"
 #include "util/statusor.h"
 
@@ -39,6 +46,13 @@ using std::vector;
  */
 class PIRDatabase {
  public:
+  /**
+   * Source of database items for streaming ingestion. Called once for each
+   * item, in order, with the index of the item to write into item. The string
+   * passed in is reused between calls, so its capacity is kept.
+   */
+  using ItemSource = std::function<Status(size_t /*index*/, string* /*item*/)>;
+
   /**
    * Creates and returns an empty PIR database with the params used to generate
    * a context.
@@ -67,6 +81,40 @@ class PIRDatabase {
   static StatusOr<shared_ptr<PIRDatabase>> Create(
       const vector<string>& /*database*/, shared_ptr<PIRParameters> params);
 
+  /**
+   * Creates a new PIR database, pulling items from the given source one
+   * plaintext's worth at a time, so that the raw items are never all in memory
+   * at once.
+   * @param[in] source Source of the database items.
+   * @param[in] PIR parameters
+   **/
+  static StatusOr<shared_ptr<PIRDatabase>> Create(
+      const ItemSource& source, shared_ptr<PIRParameters> params);
+
+  /**
+   * Creates a new PIR database from a stream of fixed width records, each
+   * bytes_per_item bytes long, such as a file.
+   * @param[in] records Stream to read the database items from.
+   * @param[in] PIR parameters
+   **/
+  static StatusOr<shared_ptr<PIRDatabase>> Create(
+      std::istream& records, shared_ptr<PIRParameters> params);
+
+  /**
+   * Opens a database from a snapshot written by Save. The plaintexts are
+   * mapped from the file rather than read, so this is fast regardless of the
+   * database size, and processes opening the same snapshot share its memory.
+   * @param[in] path Snapshot file to open.
+   **/
+  static StatusOr<shared_ptr<PIRDatabase>> Open(const string& path);
+
+  /**
+   * Writes the encoded database and its parameters to a snapshot file, to be
+   * loaded again with Open.
+   * @param[in] path Snapshot file to write.
+   */
+  Status Save(const string& path) const;
+
   /**
    * Populate the database plaintexts from a list of integers. Only really used
    * for testing.
@@ -76,30 +124,140 @@ class PIRDatabase {
   /**
    * Populate the database plaintexts from a list of strings. Items must match
    * the settings in the context or InvalidArgumentError will be returned.
+   * If preprocess_ntt is set in the parameters, plaintexts are stored in NTT
+   * form.
    */
   Status populate(const vector<string>& /*database*/);
 
+  /**
+   * Populate the database plaintexts from an item source. Only the items
+   * needed for one plaintext are held in memory at a time. Errors returned by
+   * the source are passed through.
+   */
+  Status populate(const ItemSource& /*source*/);
+
+  /**
+   * Populate the database plaintexts from a stream of fixed width records,
+   * each bytes_per_item bytes long.
+   * @returns InvalidArgumentError if the stream ends before num_items records.
+   */
+  Status populate(std::istream& /*records*/);
+
+  /**
+   * Replaces the value of a single item. Only the plaintext holding the item
+   * is decoded and encoded again, and transformed to NTT form if the
+   * parameters ask for it. Safe to call while other threads multiply: they
+   * wait for the plaintext to be written and see either the old or the new
+   * value.
+   * @param[in] index Index of the item to replace.
+   * @param[in] value New value, bytes_per_item bytes long.
+   * @returns InvalidArgumentError if the index or value size is invalid.
+   */
+  Status update(uint32_t index, const string& value);
+
+  /**
+   * Replaces the values of several items. Each affected plaintext is encoded
+   * again once, however many of its items change. If an index appears more
+   * than once, the last value wins. Either all of the updates are applied or,
+   * if any argument is invalid or a plaintext fails to encode, none of them.
+   * @param[in] updates Pairs of item index and new value.
+   */
+  Status update(const vector<std::pair<uint32_t, string>>& updates);
+
   /**
    * Multiplies the database represented as a multi-dimensional hypercube with
    * a selection vector. Selection vector is split into sub vectors based on
    * dimensions fetched from PIRParameters in the current context.
    * @param[in] selection_vector Selection vector to multiply against
+   * @param[in] pool Memory pool to allocate the result and all temporaries
+   *    from, such as one scoped to the request being handled.
    * @returns Ciphertext resulting from multiplication, or error
    */
   StatusOr<seal::Ciphertext> multiply(
       const std::vector<seal::Ciphertext>& selection_vector,
       const seal::RelinKeys* const relin_keys = nullptr,
-      seal::Decryptor* const decryptor = nullptr) const;
+      seal::Decryptor* const decryptor = nullptr,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+
+  /**
+   * Multiplies the database with several selection vectors at once, such as
+   * those of all the queries in a request. The database is scanned once, with
+   * each plaintext multiplied against every selection vector while it is still
+   * in cache, instead of once per selection vector.
+   * @param[in] selection_vectors Selection vectors to multiply against
+   * @returns One ciphertext per selection vector, in order, or error
+   */
+  StatusOr<std::vector<seal::Ciphertext>> multiply(
+      const std::vector<std::vector<seal::Ciphertext>>& selection_vectors,
+      const seal::RelinKeys* const relin_keys = nullptr,
+      seal::Decryptor* const decryptor = nullptr,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
+
+  /**
+   * Product of a one-dimensional database with a selection vector that is
+   * handed over one ciphertext at a time, in any order, such as straight out
+   * of the oblivious expansion. Each ciphertext is multiplied with its
+   * plaintext and added to the result as it arrives, so the selection vector
+   * never has to be held in memory as a whole. Not thread safe.
+   */
+  class SelectionAccumulator {
+   public:
+    /**
+     * Adds the product of a selection vector ciphertext with the plaintext at
+     * the same index. Ciphertexts past the end of the database are ignored.
+     * @param[in] index Index of the ciphertext in the selection vector.
+     * @param[in] selection Selection vector ciphertext, in coefficient form.
+     */
+    Status add(size_t index, const seal::Ciphertext& selection);
+
+    /**
+     * Returns the sum of all products added, in coefficient form. May only be
+     * called once.
+     * @returns FailedPrecondition if nothing was added.
+     */
+    StatusOr<seal::Ciphertext> result();
+
+   private:
+    friend class PIRDatabase;
+    SelectionAccumulator(const PIRDatabase& database,
+                         seal::MemoryPoolHandle pool);
+
+    const PIRDatabase& database_;
+    seal::MemoryPoolHandle pool_;
+    DotProductAccumulator dot_product_;
+    seal::Ciphertext ntt_selection_;
+    seal::Ciphertext term_;
+    seal::Ciphertext result_;
+    seal::Plaintext scratch_;
+    bool has_value_ = false;
+  };
+
+  /**
+   * Starts a streaming multiplication, see SelectionAccumulator.
+   * @param[in] pool Memory pool to allocate ciphertexts from.
+   * @returns FailedPrecondition if the database has more than one dimension.
+   */
+  StatusOr<std::unique_ptr<SelectionAccumulator>> accumulate(
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 
   /**
    * Database size.
    **/
-  std::size_t size() const { return db_.size(); }
+  std::size_t size() const {
+    return snapshot_ != nullptr ? snapshot_->size() : db_.size();
+  }
+
+  /**
+   * Sets a thread pool used to split multiplications across threads. If not
+   * set, or set to nullptr, multiplications run on the calling thread.
+   */
+  void set_thread_pool(shared_ptr<ThreadPool> pool) { thread_pool_ = pool; }
 
   /**
    * Helper function to calculate indices within the multi-dimensional
    * representation of the database for a given index in the flat
-   * representation.
+   * representation. Shortcut for IndexPlanner::calculate_indices, which
+   * doesn't need a database.
    * @param[in] dims The dimensions to use in multi-dimensional rep.
    * @param[in] index Index in the flat representation.
    * @returns Vector of indices.
@@ -107,7 +265,8 @@ class PIRDatabase {
   vector<uint32_t> calculate_indices(uint32_t index);
 
   /**
-   * Calculate the offset of an item within a plaintext.
+   * Calculate the offset of an item within a plaintext. Shortcut for
+   * IndexPlanner::calculate_item_offset.
    * @param[in] index Item index in the database
    * @returns Offset in bytes from start of the plaintext that contains item.
    */
@@ -127,8 +286,33 @@ class PIRDatabase {
       : context_(std::move(context)) {}
 
  private:
+  // Transforms a freshly encoded plaintext to NTT form if the parameters ask
+  // for it, otherwise leaves it untouched.
+  Status preprocess(seal::Plaintext& pt);
+
+  StatusOr<std::vector<seal::Ciphertext>> multiply(
+      const std::vector<const std::vector<seal::Ciphertext>*>&
+          selection_vectors,
+      const seal::RelinKeys* const relin_keys,
+      seal::Decryptor* const decryptor, seal::MemoryPoolHandle pool) const;
+
+  // Returns plaintext i in coefficient form, undoing the NTT if needed.
+  Status get_coefficients(size_t i, seal::Plaintext& destination) const;
+
+  // Number of coefficients stored for each plaintext in a snapshot.
+  size_t snapshot_slot_words() const;
+
   vector<seal::Plaintext> db_;
+
+  // Held shared while plaintexts are read by a multiplication or saved, and
+  // exclusively while update() rewrites them.
+  mutable std::shared_mutex plaintexts_mutex_;
+
+  // If not null, plaintexts are read from this snapshot instead of db_.
+  std::unique_ptr<DatabaseSnapshot> snapshot_;
+
   std::unique_ptr<PIRContext> context_;
+  shared_ptr<ThreadPool> thread_pool_;
 };
 
 }  // namespace pir
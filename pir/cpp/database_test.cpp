@@ -15,7 +15,10 @@
 //
 
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 #include "gmock/gmock.h"
@@ -58,8 +61,9 @@ class PIRDatabaseTest : public ::testing::Test, public PIRTestingBase {
 
   void SetUpDB(size_t dbsize, size_t dimensions = 1,
                uint32_t poly_modulus_degree = POLY_MODULUS_DEGREE,
-               uint32_t plain_mod_bit_size = 20) {
+               uint32_t plain_mod_bit_size = 20, bool preprocess_ntt = false) {
     SetUpParams(dbsize, 0, dimensions, poly_modulus_degree, plain_mod_bit_size);
+    pir_params_->set_preprocess_ntt(preprocess_ntt);
     GenerateIntDB();
     SetUpSealTools();
     encoder_ = make_unique<seal::IntegerEncoder>(seal_context_);
@@ -67,9 +71,11 @@ class PIRDatabaseTest : public ::testing::Test, public PIRTestingBase {
 
   void SetUpStringDB(size_t dbsize, size_t dimensions = 1,
                      uint32_t poly_modulus_degree = POLY_MODULUS_DEGREE,
-                     uint32_t plain_mod_bit_size = 20, size_t elem_size = 0) {
+                     uint32_t plain_mod_bit_size = 20, size_t elem_size = 0,
+                     bool preprocess_ntt = false) {
     SetUpParams(dbsize, elem_size, dimensions, poly_modulus_degree,
                 plain_mod_bit_size);
+    pir_params_->set_preprocess_ntt(preprocess_ntt);
     GenerateDB();
     SetUpSealTools();
   }
@@ -101,6 +107,135 @@ TEST_F(PIRDatabaseTest, TestMultiply) {
   EXPECT_THAT(result, Eq(expected));
 }
 
+TEST_F(PIRDatabaseTest, TestMultiplyNTT) {
+  SetUpDB(100, 1, POLY_MODULUS_DEGREE, 20, true);
+  vector<int32_t> v(db_size_);
+  std::generate(v.begin(), v.end(),
+                [n = -db_size_ / 2]() mutable { return n; });
+  ASSERT_THAT(pir_db_->size(), Eq(v.size()));
+
+  vector<Ciphertext> cts(v.size());
+  int64_t expected = 0;
+  for (size_t i = 0; i < cts.size(); ++i) {
+    Plaintext pt;
+    encoder_->encode(v[i], pt);
+    encryptor_->encrypt(pt, cts[i]);
+    expected += v[i] * int_db_[i];
+  }
+
+  ASSIGN_OR_FAIL(auto result_ct, pir_db_->multiply(cts));
+  ASSERT_FALSE(result_ct.is_ntt_form());
+
+  Plaintext pt;
+  decryptor_->decrypt(result_ct, pt);
+  auto result = encoder_->decode_int64(pt);
+
+  EXPECT_THAT(result, Eq(expected));
+}
+
+TEST_F(PIRDatabaseTest, TestAccumulate) {
+  for (bool ntt : {false, true}) {
+    SetUpDB(100, 1, POLY_MODULUS_DEGREE, 20, ntt);
+    auto accumulator_or = pir_db_->accumulate();
+    ASSERT_OK(accumulator_or.status());
+    auto accumulator = std::move(accumulator_or.ValueOrDie());
+
+    int64_t expected = 0;
+    // Ciphertexts may arrive in any order, and past the end of the database.
+    for (size_t i = db_size_ + 2; i-- > 0;) {
+      const int64_t v = static_cast<int64_t>(i) - 50;
+      Plaintext pt;
+      encoder_->encode(v, pt);
+      Ciphertext ct;
+      encryptor_->encrypt(pt, ct);
+      ASSERT_OK(accumulator->add(i, ct));
+      if (i < db_size_) {
+        expected += v * int_db_[i];
+      }
+    }
+
+    ASSIGN_OR_FAIL(auto result_ct, accumulator->result());
+    ASSERT_FALSE(result_ct.is_ntt_form());
+    Plaintext pt;
+    decryptor_->decrypt(result_ct, pt);
+    EXPECT_THAT(encoder_->decode_int64(pt), Eq(expected)) << "ntt = " << ntt;
+  }
+}
+
+TEST_F(PIRDatabaseTest, TestAccumulateMultiDim) {
+  SetUpDB(100, 2, POLY_MODULUS_DEGREE, 20);
+  auto accumulator_or = pir_db_->accumulate();
+  ASSERT_THAT(accumulator_or.status().code(),
+              Eq(private_join_and_compute::StatusCode::kFailedPrecondition));
+}
+
+TEST_F(PIRDatabaseTest, TestMultiplyParallelNTT) {
+  SetUpDB(100, 1, POLY_MODULUS_DEGREE, 20, true);
+  pir_db_->set_thread_pool(std::make_shared<ThreadPool>(4));
+
+  vector<Ciphertext> cts(db_size_);
+  int64_t expected = 0;
+  for (size_t i = 0; i < cts.size(); ++i) {
+    const int64_t v = static_cast<int64_t>(i) - 50;
+    Plaintext pt;
+    encoder_->encode(v, pt);
+    encryptor_->encrypt(pt, cts[i]);
+    expected += v * int_db_[i];
+  }
+
+  ASSIGN_OR_FAIL(auto result_ct, pir_db_->multiply(cts));
+
+  Plaintext pt;
+  decryptor_->decrypt(result_ct, pt);
+  EXPECT_THAT(encoder_->decode_int64(pt), Eq(expected));
+}
+
+TEST_F(PIRDatabaseTest, TestMultiplyFromSnapshot) {
+  const string path = ::testing::TempDir() + "/database_test_snapshot";
+  ASSERT_OK(pir_db_->Save(path));
+  ASSIGN_OR_FAIL(auto snapshot_db, PIRDatabase::Open(path));
+  std::remove(path.c_str());
+  ASSERT_THAT(snapshot_db->size(), Eq(pir_db_->size()));
+
+  vector<Ciphertext> cts(db_size_);
+  int64_t expected = 0;
+  for (size_t i = 0; i < cts.size(); ++i) {
+    const int64_t v = static_cast<int64_t>(i) - 50;
+    Plaintext pt;
+    encoder_->encode(v, pt);
+    encryptor_->encrypt(pt, cts[i]);
+    expected += v * int_db_[i];
+  }
+
+  ASSIGN_OR_FAIL(auto result_ct, snapshot_db->multiply(cts));
+
+  Plaintext pt;
+  decryptor_->decrypt(result_ct, pt);
+  EXPECT_THAT(encoder_->decode_int64(pt), Eq(expected));
+}
+
+TEST_F(PIRDatabaseTest, TestOpenMissingSnapshot) {
+  auto pir_db_or =
+      PIRDatabase::Open(::testing::TempDir() + "/database_test_missing");
+  ASSERT_THAT(pir_db_or.status().code(),
+              Eq(private_join_and_compute::StatusCode::kNotFound));
+}
+
+TEST_F(PIRDatabaseTest, TestMultiplyBatchSelectionVectorWrongSize) {
+  vector<vector<Ciphertext>> selection_vectors(2);
+  for (auto& selection_vector : selection_vectors) {
+    selection_vector.resize(db_size_);
+    for (auto& ct : selection_vector) {
+      encryptor_->encrypt_zero(ct);
+    }
+  }
+  selection_vectors[1].pop_back();
+
+  auto results_or = pir_db_->multiply(selection_vectors);
+  ASSERT_THAT(results_or.status().code(),
+              Eq(private_join_and_compute::StatusCode::kInvalidArgument));
+}
+
 TEST_F(PIRDatabaseTest, TestMultiplySelectionVectorTooSmall) {
   SetUpDB(100, 2);
   const uint32_t desired_index = 42;
@@ -262,6 +397,140 @@ TEST_F(PIRDatabaseTest, TestCreateValueDoesntMatch) {
             private_join_and_compute::StatusCode::kInvalidArgument);
 }
 
+// Returns the contents of the snapshot of a database.
+string snapshot_contents(const PIRDatabase& db, const string& name) {
+  const string path = ::testing::TempDir() + "/" + name;
+  if (!db.Save(path).ok()) return "";
+  std::ifstream in(path, std::ios::binary);
+  const string contents((std::istreambuf_iterator<char>(in)),
+                        std::istreambuf_iterator<char>());
+  std::remove(path.c_str());
+  return contents;
+}
+
+TEST_F(PIRDatabaseTest, TestCreateFromStream) {
+  SetUpStringDB(1000, 2, POLY_MODULUS_DEGREE, 16, 128, true);
+  std::stringstream records;
+  for (const auto& item : string_db_) {
+    records << item;
+  }
+
+  ASSIGN_OR_FAIL(auto stream_db, PIRDatabase::Create(records, pir_params_));
+
+  ASSERT_EQ(stream_db->size(), pir_db_->size());
+  EXPECT_EQ(snapshot_contents(*stream_db, "stream_db"),
+            snapshot_contents(*pir_db_, "vector_db"));
+}
+
+TEST_F(PIRDatabaseTest, TestCreateFromStreamTooShort) {
+  SetUpStringDB(100, 1, POLY_MODULUS_DEGREE, 16, 128);
+  std::stringstream records;
+  for (size_t i = 0; i < string_db_.size() - 1; ++i) {
+    records << string_db_[i];
+  }
+
+  auto pir_db_or = PIRDatabase::Create(records, pir_params_);
+  ASSERT_EQ(pir_db_or.status().code(),
+            private_join_and_compute::StatusCode::kInvalidArgument);
+}
+
+TEST_F(PIRDatabaseTest, TestCreateFromSource) {
+  SetUpStringDB(100, 1, POLY_MODULUS_DEGREE, 16, 128);
+  vector<size_t> requested;
+
+  ASSIGN_OR_FAIL(auto source_db,
+                 PIRDatabase::Create(
+                     [&](size_t index, string* item) {
+                       requested.push_back(index);
+                       *item = string_db_[index];
+                       return Status::OK;
+                     },
+                     pir_params_));
+
+  EXPECT_EQ(requested.size(), string_db_.size());
+  EXPECT_TRUE(std::is_sorted(requested.begin(), requested.end()));
+  EXPECT_EQ(snapshot_contents(*source_db, "source_db"),
+            snapshot_contents(*pir_db_, "vector_db"));
+}
+
+TEST_F(PIRDatabaseTest, TestCreateFromSourceError) {
+  SetUpStringDB(100, 1, POLY_MODULUS_DEGREE, 16, 128);
+
+  auto pir_db_or = PIRDatabase::Create(
+      [&](size_t index, string* item) {
+        if (index == 42) {
+          return private_join_and_compute::NotFoundError("missing item");
+        }
+        *item = string_db_[index];
+        return Status::OK;
+      },
+      pir_params_);
+  ASSERT_EQ(pir_db_or.status().code(),
+            private_join_and_compute::StatusCode::kNotFound);
+}
+
+class UpdateTest : public PIRDatabaseTest,
+                   public testing::WithParamInterface<tuple<bool, bool>> {
+ protected:
+  void SetUp() {
+    SetUpStringDB(1000, 2, POLY_MODULUS_DEGREE, 16, 128, get<0>(GetParam()));
+    if (get<1>(GetParam())) {
+      const string path = ::testing::TempDir() + "/update_test_snapshot";
+      ASSERT_OK(pir_db_->Save(path));
+      ASSIGN_OR_FAIL(pir_db_, PIRDatabase::Open(path));
+      std::remove(path.c_str());
+    }
+  }
+
+  // Snapshot of a database built from scratch with the current values.
+  string ExpectedContents() {
+    auto expected_db =
+        PIRDatabase::Create(string_db_, pir_params_).ValueOrDie();
+    return snapshot_contents(*expected_db, "update_test_expected");
+  }
+};
+
+TEST_P(UpdateTest, TestUpdate) {
+  const auto new_values = generate_test_db(1, 128, 7);
+  ASSERT_OK(pir_db_->update(754, new_values[0]));
+  string_db_[754] = new_values[0];
+
+  EXPECT_EQ(snapshot_contents(*pir_db_, "update_test_actual"),
+            ExpectedContents());
+}
+
+TEST_P(UpdateTest, TestUpdateBatch) {
+  const auto new_values = generate_test_db(5, 128, 7);
+  vector<std::pair<uint32_t, string>> updates = {{999, new_values[0]},
+                                                 {0, new_values[1]},
+                                                 {1, new_values[2]},
+                                                 {500, new_values[3]},
+                                                 {0, new_values[4]}};
+  ASSERT_OK(pir_db_->update(updates));
+  string_db_[999] = new_values[0];
+  string_db_[1] = new_values[2];
+  string_db_[500] = new_values[3];
+  string_db_[0] = new_values[4];
+
+  EXPECT_EQ(snapshot_contents(*pir_db_, "update_test_actual"),
+            ExpectedContents());
+}
+
+TEST_P(UpdateTest, TestUpdateInvalid) {
+  const string before = snapshot_contents(*pir_db_, "update_test_before");
+  const auto new_values = generate_test_db(1, 128, 7);
+
+  EXPECT_EQ(pir_db_->update({{1, new_values[0]}, {1000, new_values[0]}})
+                .code(),
+            private_join_and_compute::StatusCode::kInvalidArgument);
+  EXPECT_EQ(pir_db_->update(1, new_values[0].substr(1)).code(),
+            private_join_and_compute::StatusCode::kInvalidArgument);
+  EXPECT_EQ(snapshot_contents(*pir_db_, "update_test_after"), before);
+}
+
+INSTANTIATE_TEST_SUITE_P(PIRDatabaseUpdates, UpdateTest,
+                         testing::Combine(testing::Bool(), testing::Bool()));
+
 class MultiplyMultiDimTest
     : public PIRDatabaseTest,
       public testing::WithParamInterface<
@@ -292,6 +561,141 @@ TEST_P(MultiplyMultiDimTest, TestMultiply) {
   EXPECT_THAT(result, Eq(string_db_[desired_index]));
 }
 
+TEST_P(MultiplyMultiDimTest, TestMultiplyNTT) {
+  const auto poly_modulus_degree = get<0>(GetParam());
+  const auto plain_mod_bits = get<1>(GetParam());
+  const auto dbsize = get<2>(GetParam());
+  const auto d = get<3>(GetParam());
+  const auto desired_index = get<4>(GetParam());
+  SetUpStringDB(dbsize, d, poly_modulus_degree, plain_mod_bits, 0, true);
+  const size_t elem_size = pir_params_->bytes_per_item();
+  const auto dims = PIRDatabase::calculate_dimensions(dbsize, d);
+  const auto indices = pir_db_->calculate_indices(desired_index);
+  const auto cts = create_selection_vector(dims, indices, *encryptor_);
+
+  auto relin_keys = keygen_->relin_keys_local();
+  ASSIGN_OR_FAIL(auto result_ct, pir_db_->multiply(cts, &relin_keys));
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result_ct, result_pt);
+  auto string_encoder = make_unique<StringEncoder>(seal_context_);
+  ASSIGN_OR_FAIL(auto result, string_encoder->decode(result_pt, elem_size));
+  EXPECT_THAT(result, Eq(string_db_[desired_index]));
+}
+
+TEST_P(MultiplyMultiDimTest, TestMultiplyMemoryPool) {
+  const auto poly_modulus_degree = get<0>(GetParam());
+  const auto plain_mod_bits = get<1>(GetParam());
+  const auto dbsize = get<2>(GetParam());
+  const auto d = get<3>(GetParam());
+  const auto desired_index = get<4>(GetParam());
+  SetUpStringDB(dbsize, d, poly_modulus_degree, plain_mod_bits, 0, true);
+  const size_t elem_size = pir_params_->bytes_per_item();
+  const auto dims = PIRDatabase::calculate_dimensions(dbsize, d);
+  const auto indices = pir_db_->calculate_indices(desired_index);
+  const auto cts = create_selection_vector(dims, indices, *encryptor_);
+
+  auto pool = seal::MemoryPoolHandle::New();
+  auto relin_keys = keygen_->relin_keys_local();
+  ASSIGN_OR_FAIL(auto result_ct,
+                 pir_db_->multiply(cts, &relin_keys, nullptr, pool));
+  EXPECT_GT(pool.alloc_byte_count(), 0u);
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result_ct, result_pt);
+  auto string_encoder = make_unique<StringEncoder>(seal_context_);
+  ASSIGN_OR_FAIL(auto result, string_encoder->decode(result_pt, elem_size));
+  EXPECT_THAT(result, Eq(string_db_[desired_index]));
+}
+
+TEST_P(MultiplyMultiDimTest, TestMultiplyParallel) {
+  const auto poly_modulus_degree = get<0>(GetParam());
+  const auto plain_mod_bits = get<1>(GetParam());
+  const auto dbsize = get<2>(GetParam());
+  const auto d = get<3>(GetParam());
+  const auto desired_index = get<4>(GetParam());
+  SetUpStringDB(dbsize, d, poly_modulus_degree, plain_mod_bits);
+  pir_db_->set_thread_pool(std::make_shared<ThreadPool>(3));
+  const size_t elem_size = pir_params_->bytes_per_item();
+  const auto dims = PIRDatabase::calculate_dimensions(dbsize, d);
+  const auto indices = pir_db_->calculate_indices(desired_index);
+  const auto cts = create_selection_vector(dims, indices, *encryptor_);
+
+  auto relin_keys = keygen_->relin_keys_local();
+  ASSIGN_OR_FAIL(auto result_ct, pir_db_->multiply(cts, &relin_keys));
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result_ct, result_pt);
+  auto string_encoder = make_unique<StringEncoder>(seal_context_);
+  ASSIGN_OR_FAIL(auto result, string_encoder->decode(result_pt, elem_size));
+  EXPECT_THAT(result, Eq(string_db_[desired_index]));
+}
+
+TEST_P(MultiplyMultiDimTest, TestMultiplyBatch) {
+  const auto poly_modulus_degree = get<0>(GetParam());
+  const auto plain_mod_bits = get<1>(GetParam());
+  const auto dbsize = get<2>(GetParam());
+  const auto d = get<3>(GetParam());
+  const auto desired_index = get<4>(GetParam());
+  const vector<uint32_t> desired_indices = {desired_index, 0, dbsize - 1,
+                                            desired_index};
+
+  for (bool preprocess_ntt : {false, true}) {
+    SetUpStringDB(dbsize, d, poly_modulus_degree, plain_mod_bits, 0,
+                  preprocess_ntt);
+    const size_t elem_size = pir_params_->bytes_per_item();
+    const auto dims = PIRDatabase::calculate_dimensions(dbsize, d);
+    vector<vector<Ciphertext>> selection_vectors;
+    for (auto index : desired_indices) {
+      const auto indices = pir_db_->calculate_indices(index);
+      selection_vectors.push_back(
+          create_selection_vector(dims, indices, *encryptor_));
+    }
+
+    auto relin_keys = keygen_->relin_keys_local();
+    ASSIGN_OR_FAIL(auto result_cts,
+                   pir_db_->multiply(selection_vectors, &relin_keys));
+    ASSERT_EQ(result_cts.size(), desired_indices.size());
+
+    auto string_encoder = make_unique<StringEncoder>(seal_context_);
+    for (size_t q = 0; q < desired_indices.size(); ++q) {
+      Plaintext result_pt;
+      decryptor_->decrypt(result_cts[q], result_pt);
+      ASSIGN_OR_FAIL(auto result,
+                     string_encoder->decode(result_pt, elem_size));
+      EXPECT_THAT(result, Eq(string_db_[desired_indices[q]]))
+          << "query " << q << ", preprocess_ntt " << preprocess_ntt;
+    }
+  }
+}
+
+TEST_P(MultiplyMultiDimTest, TestMultiplyFromSnapshotNTT) {
+  const auto poly_modulus_degree = get<0>(GetParam());
+  const auto plain_mod_bits = get<1>(GetParam());
+  const auto dbsize = get<2>(GetParam());
+  const auto d = get<3>(GetParam());
+  const auto desired_index = get<4>(GetParam());
+  SetUpStringDB(dbsize, d, poly_modulus_degree, plain_mod_bits, 0, true);
+  const string path = ::testing::TempDir() + "/multi_dim_test_snapshot";
+  ASSERT_OK(pir_db_->Save(path));
+  ASSIGN_OR_FAIL(auto snapshot_db, PIRDatabase::Open(path));
+  std::remove(path.c_str());
+
+  const size_t elem_size = pir_params_->bytes_per_item();
+  const auto dims = PIRDatabase::calculate_dimensions(dbsize, d);
+  const auto indices = pir_db_->calculate_indices(desired_index);
+  const auto cts = create_selection_vector(dims, indices, *encryptor_);
+
+  auto relin_keys = keygen_->relin_keys_local();
+  ASSIGN_OR_FAIL(auto result_ct, snapshot_db->multiply(cts, &relin_keys));
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result_ct, result_pt);
+  auto string_encoder = make_unique<StringEncoder>(seal_context_);
+  ASSIGN_OR_FAIL(auto result, string_encoder->decode(result_pt, elem_size));
+  EXPECT_THAT(result, Eq(string_db_[desired_index]));
+}
+
 INSTANTIATE_TEST_SUITE_P(PIRDatabaseMultiplies, MultiplyMultiDimTest,
                          testing::Values(make_tuple(4096, 16, 10, 1, 7),
                                          make_tuple(4096, 16, 16, 2, 11),
@@ -0,0 +1,183 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/dot_product.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "seal/seal.h"
+#include "seal/util/uintarithsmallmod.h"
+
+namespace pir {
+
+using seal::Ciphertext;
+using seal::Plaintext;
+
+namespace {
+
+// Reduces a 128-bit value modulo a coefficient modulus.
+inline uint64_t reduce_lane(unsigned __int128 lane,
+                            const seal::Modulus& modulus) {
+  const uint64_t parts[2] = {static_cast<uint64_t>(lane),
+                             static_cast<uint64_t>(lane >> 64)};
+  return seal::util::barrett_reduce_128(parts, modulus);
+}
+
+}  // namespace
+
+DotProductAccumulator::DotProductAccumulator(
+    shared_ptr<seal::SEALContext> context, seal::MemoryPoolHandle pool)
+    : DotProductAccumulator(context, context->first_parms_id(), pool) {}
+
+DotProductAccumulator::DotProductAccumulator(
+    shared_ptr<seal::SEALContext> context, seal::parms_id_type parms_id,
+    seal::MemoryPoolHandle pool)
+    : context_(context), parms_id_(parms_id), pool_(pool) {
+  auto context_data = context_->get_context_data(parms_id_);
+  if (!context_data) {
+    throw std::invalid_argument("parms_id is not valid for context");
+  }
+  const auto& parms = context_data->parms();
+  coeff_modulus_ = parms.coeff_modulus();
+  poly_modulus_degree_ = parms.poly_modulus_degree();
+
+  // A lane holds a value below q after each reduction, plus products of two
+  // values below q, so 2^(128 - 2 * bits(q)) products fit before the next one.
+  int max_bits = 0;
+  for (const auto& modulus : coeff_modulus_) {
+    max_bits = std::max(max_bits, modulus.bit_count());
+  }
+  const int headroom_bits = std::min(128 - 2 * max_bits, 62);
+  max_pending_ = (headroom_bits > 0) ? (size_t(1) << headroom_bits) : 1;
+}
+
+void DotProductAccumulator::multiply_add(const Ciphertext& ct,
+                                         const Plaintext& pt) {
+  if (!pt.is_ntt_form()) {
+    throw std::invalid_argument("operands must be in NTT form");
+  }
+  if (pt.parms_id() != parms_id_) {
+    throw std::invalid_argument("operands are not at the accumulator level");
+  }
+  multiply_add(ct, pt.data());
+}
+
+void DotProductAccumulator::multiply_add(const Ciphertext& ct,
+                                         const uint64_t* pt_data) {
+  check_operand(ct);
+  if (pending_ == max_pending_) {
+    reduce();
+  }
+  add_product(ct, pt_data, 0, poly_modulus_degree_);
+  ++pending_;
+}
+
+void DotProductAccumulator::reserve_terms(size_t count) {
+  if (count > max_pending_) {
+    throw std::invalid_argument("too many terms between reductions");
+  }
+  if (pending_ + count > max_pending_) {
+    reduce();
+  }
+  pending_ += count;
+}
+
+void DotProductAccumulator::multiply_add(const Ciphertext& ct,
+                                         const uint64_t* pt_data, size_t begin,
+                                         size_t end) {
+  check_operand(ct);
+  if (begin > end || end > poly_modulus_degree_) {
+    throw std::invalid_argument("coefficient range is out of bounds");
+  }
+  add_product(ct, pt_data, begin, end);
+}
+
+void DotProductAccumulator::check_operand(const Ciphertext& ct) {
+  if (!ct.is_ntt_form()) {
+    throw std::invalid_argument("operands must be in NTT form");
+  }
+  if (ct.parms_id() != parms_id_) {
+    throw std::invalid_argument("operands are not at the accumulator level");
+  }
+  if (ct_size_ == 0) {
+    ct_size_ = ct.size();
+    lane_count_ = ct_size_ * coeff_modulus_.size() * poly_modulus_degree_;
+    lanes_ = seal::util::allocate<unsigned __int128>(lane_count_, pool_);
+    std::fill_n(lanes_.get(), lane_count_, 0);
+  } else if (ct.size() != ct_size_) {
+    throw std::invalid_argument("ciphertext sizes do not match");
+  }
+}
+
+void DotProductAccumulator::add_product(const Ciphertext& ct,
+                                        const uint64_t* pt_data, size_t begin,
+                                        size_t end) {
+  const size_t coeff_mod_count = coeff_modulus_.size();
+  const size_t n = poly_modulus_degree_;
+  for (size_t p = 0; p < ct_size_; ++p) {
+    for (size_t j = 0; j < coeff_mod_count; ++j) {
+      const uint64_t* ct_limb = ct.data(p) + j * n;
+      const uint64_t* pt_limb = pt_data + j * n;
+      unsigned __int128* lanes = lanes_.get() + (p * coeff_mod_count + j) * n;
+      for (size_t i = begin; i < end; ++i) {
+        lanes[i] += static_cast<unsigned __int128>(ct_limb[i]) * pt_limb[i];
+      }
+    }
+  }
+}
+
+void DotProductAccumulator::reduce() {
+  const size_t coeff_mod_count = coeff_modulus_.size();
+  const size_t n = poly_modulus_degree_;
+  for (size_t p = 0; p < ct_size_; ++p) {
+    for (size_t j = 0; j < coeff_mod_count; ++j) {
+      unsigned __int128* lanes = lanes_.get() + (p * coeff_mod_count + j) * n;
+      for (size_t i = 0; i < n; ++i) {
+        lanes[i] = reduce_lane(lanes[i], coeff_modulus_[j]);
+      }
+    }
+  }
+  pending_ = 0;
+}
+
+void DotProductAccumulator::get_result(Ciphertext& destination) {
+  const size_t coeff_mod_count = coeff_modulus_.size();
+  const size_t n = poly_modulus_degree_;
+  const size_t ct_size = std::max<size_t>(ct_size_, 2);
+  destination.resize(context_, parms_id_, ct_size);
+  destination.is_ntt_form() = true;
+  for (size_t p = 0; p < ct_size; ++p) {
+    for (size_t j = 0; j < coeff_mod_count; ++j) {
+      uint64_t* out = destination.data(p) + j * n;
+      if (p >= ct_size_) {
+        std::fill(out, out + n, 0);
+        continue;
+      }
+      const unsigned __int128* lanes =
+          lanes_.get() + (p * coeff_mod_count + j) * n;
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = reduce_lane(lanes[i], coeff_modulus_[j]);
+      }
+    }
+  }
+}
+
+void DotProductAccumulator::reset() {
+  std::fill_n(lanes_.get(), lane_count_, 0);
+  pending_ = 0;
+}
+
+}  // namespace pir
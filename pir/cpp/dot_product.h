@@ -0,0 +1,149 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PIR_DOT_PRODUCT_H_
+#define PIR_DOT_PRODUCT_H_
+
+#include <memory>
+#include <vector>
+
+#include "seal/seal.h"
+#include "seal/util/pointer.h"
+
+namespace pir {
+
+using std::shared_ptr;
+using std::vector;
+
+/**
+ * Computes the dot product of a list of ciphertexts with a list of plaintexts,
+ * both in NTT form, by working directly on their RNS limbs. Instead of doing a
+ * multiply_plain and add_inplace per term, with a full modular reduction and a
+ * temporary ciphertext each time, products are summed in 128-bit lanes and
+ * only reduced when the lanes could overflow, or when the result is read.
+ *
+ * Like the SEAL evaluator, methods throw std::invalid_argument on bad input.
+ */
+class DotProductAccumulator {
+ public:
+  /**
+   * Creates an empty accumulator for ciphertexts at the first data level,
+   * which is where fresh ciphertexts and the database live.
+   * @param[in] context SEAL context the operands belong to.
+   * @param[in] pool Memory pool to allocate the lanes from.
+   */
+  explicit DotProductAccumulator(
+      shared_ptr<seal::SEALContext> context,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+
+  /**
+   * Creates an empty accumulator for ciphertexts at the given level.
+   * @param[in] context SEAL context the operands belong to.
+   * @param[in] parms_id Level of the operands.
+   * @param[in] pool Memory pool to allocate the lanes from.
+   */
+  DotProductAccumulator(
+      shared_ptr<seal::SEALContext> context, seal::parms_id_type parms_id,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+
+  /**
+   * Adds ct * pt to the accumulated sum.
+   * @param[in] ct Ciphertext in NTT form at the accumulator's level.
+   * @param[in] pt Plaintext in NTT form at the accumulator's level.
+   */
+  void multiply_add(const seal::Ciphertext& ct, const seal::Plaintext& pt);
+
+  /**
+   * Adds ct * pt, for a plaintext held outside of a seal::Plaintext.
+   * @param[in] ct Ciphertext in NTT form at the accumulator's level.
+   * @param[in] pt_data Coefficients of a plaintext in NTT form at the
+   *    accumulator's level, one polynomial per coefficient modulus.
+   */
+  void multiply_add(const seal::Ciphertext& ct, const uint64_t* pt_data);
+
+  /**
+   * Makes room for count terms added a slice at a time, with the multiply_add
+   * overload below, reducing first if the lanes could overflow. All of the
+   * coefficients of those terms have to be added before the next call.
+   * @param[in] count Number of terms, at most max_pending().
+   */
+  void reserve_terms(size_t count);
+
+  /**
+   * Adds coefficients [begin, end) of each polynomial and RNS limb of
+   * ct * pt, so that a long dot product can be done one slice of coefficients
+   * at a time, keeping the slices of every operand in cache. The terms must
+   * have been made room for with reserve_terms.
+   * @param[in] ct Ciphertext in NTT form at the accumulator's level.
+   * @param[in] pt_data Coefficients of a plaintext in NTT form at the
+   *    accumulator's level, one polynomial per coefficient modulus.
+   * @param[in] begin First coefficient of the slice.
+   * @param[in] end End of the slice, at most the polynomial modulus degree.
+   */
+  void multiply_add(const seal::Ciphertext& ct, const uint64_t* pt_data,
+                    size_t begin, size_t end);
+
+  /**
+   * Reduces the accumulated sum and writes it out as an NTT form ciphertext.
+   * The accumulator is left unchanged.
+   * @param[out] destination Ciphertext to hold the dot product.
+   */
+  void get_result(seal::Ciphertext& destination);
+
+  /**
+   * Sets the accumulated sum back to zero, keeping the allocated lanes.
+   */
+  void reset();
+
+  /**
+   * Number of terms that can be added between two reductions without any
+   * 128-bit lane overflowing.
+   */
+  size_t max_pending() const { return max_pending_; }
+
+ private:
+  void reduce();
+
+  // Checks that ct can be added, and allocates the lanes on the first call.
+  void check_operand(const seal::Ciphertext& ct);
+
+  // Adds coefficients [begin, end) of ct * pt without counting the term.
+  void add_product(const seal::Ciphertext& ct, const uint64_t* pt_data,
+                   size_t begin, size_t end);
+
+  shared_ptr<seal::SEALContext> context_;
+  seal::parms_id_type parms_id_;
+  vector<seal::Modulus> coeff_modulus_;
+  size_t poly_modulus_degree_;
+  size_t max_pending_;
+
+  // Number of polynomials in the ciphertexts added so far, 0 if none yet.
+  size_t ct_size_ = 0;
+
+  // Number of terms added since the last reduction.
+  size_t pending_ = 0;
+
+  // One lane per coefficient of the result ciphertext, in SEAL's layout:
+  // polynomial, then RNS limb, then coefficient. Allocated from pool_ once
+  // the size of the ciphertexts is known.
+  seal::MemoryPoolHandle pool_;
+  seal::util::Pointer<unsigned __int128> lanes_;
+  size_t lane_count_ = 0;
+};
+
+}  // namespace pir
+
+#endif  // PIR_DOT_PRODUCT_H_
@@ -0,0 +1,189 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/dot_product.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "seal/seal.h"
+
+namespace pir {
+namespace {
+
+using std::make_unique;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::vector;
+
+using namespace seal;
+using namespace ::testing;
+
+constexpr uint32_t POLY_MODULUS_DEGREE = 4096;
+
+class DotProductTest : public ::testing::Test {
+ protected:
+  void SetUpContext(vector<int> coeff_bit_sizes) {
+    EncryptionParameters parms(scheme_type::BFV);
+    parms.set_poly_modulus_degree(POLY_MODULUS_DEGREE);
+    parms.set_coeff_modulus(
+        CoeffModulus::Create(POLY_MODULUS_DEGREE, coeff_bit_sizes));
+    parms.set_plain_modulus(PlainModulus::Batching(POLY_MODULUS_DEGREE, 20));
+    seal_context_ = SEALContext::Create(parms, true, sec_level_type::none);
+    keygen_ = make_unique<KeyGenerator>(seal_context_);
+    encryptor_ = make_unique<Encryptor>(seal_context_, keygen_->public_key());
+    evaluator_ = make_unique<Evaluator>(seal_context_);
+    decryptor_ = make_unique<Decryptor>(seal_context_, keygen_->secret_key());
+  }
+
+  // Generates random NTT form ciphertexts and plaintexts to multiply.
+  void GenerateOperands(size_t count) {
+    std::mt19937_64 rand(42);
+    const uint64_t plain_modulus =
+        seal_context_->first_context_data()->parms().plain_modulus().value();
+    cts_.resize(count);
+    pts_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      Plaintext pt(POLY_MODULUS_DEGREE);
+      for (size_t j = 0; j < POLY_MODULUS_DEGREE; ++j) {
+        pt[j] = rand() % plain_modulus;
+      }
+      encryptor_->encrypt(Plaintext(std::to_string(i % 7 + 1)), cts_[i]);
+      evaluator_->transform_to_ntt_inplace(cts_[i]);
+      evaluator_->transform_to_ntt(pt, seal_context_->first_parms_id(),
+                                   pts_[i]);
+    }
+  }
+
+  // Computes the dot product with the evaluator, one term at a time.
+  Ciphertext ExpectedResult() {
+    Ciphertext result;
+    for (size_t i = 0; i < cts_.size(); ++i) {
+      Ciphertext temp;
+      evaluator_->multiply_plain(cts_[i], pts_[i], temp);
+      if (i == 0) {
+        result = temp;
+      } else {
+        evaluator_->add_inplace(result, temp);
+      }
+    }
+    return result;
+  }
+
+  void ExpectSameCiphertext(const Ciphertext& actual,
+                            const Ciphertext& expected) {
+    ASSERT_TRUE(actual.is_ntt_form());
+    ASSERT_EQ(actual.parms_id(), expected.parms_id());
+    ASSERT_EQ(actual.size(), expected.size());
+    const size_t count = actual.size() * actual.coeff_modulus_size() *
+                         actual.poly_modulus_degree();
+    EXPECT_THAT(vector<uint64_t>(actual.data(), actual.data() + count),
+                ElementsAreArray(expected.data(), count));
+  }
+
+  shared_ptr<SEALContext> seal_context_;
+  unique_ptr<KeyGenerator> keygen_;
+  unique_ptr<Encryptor> encryptor_;
+  unique_ptr<Evaluator> evaluator_;
+  unique_ptr<Decryptor> decryptor_;
+  vector<Ciphertext> cts_;
+  vector<Plaintext> pts_;
+};
+
+TEST_F(DotProductTest, TestMatchesEvaluator) {
+  SetUpContext({36, 36, 37});
+  GenerateOperands(10);
+
+  DotProductAccumulator accumulator(seal_context_);
+  for (size_t i = 0; i < cts_.size(); ++i) {
+    accumulator.multiply_add(cts_[i], pts_[i]);
+  }
+  Ciphertext result;
+  accumulator.get_result(result);
+
+  ExpectSameCiphertext(result, ExpectedResult());
+}
+
+TEST_F(DotProductTest, TestReducesBeforeOverflow) {
+  // With 60 bit moduli only 256 products fit in a lane between reductions.
+  SetUpContext({60, 60, 60});
+  GenerateOperands(300);
+
+  DotProductAccumulator accumulator(seal_context_);
+  ASSERT_EQ(accumulator.max_pending(), 256u);
+  for (size_t i = 0; i < cts_.size(); ++i) {
+    accumulator.multiply_add(cts_[i], pts_[i]);
+  }
+  Ciphertext result;
+  accumulator.get_result(result);
+
+  ExpectSameCiphertext(result, ExpectedResult());
+}
+
+TEST_F(DotProductTest, TestSlices) {
+  SetUpContext({60, 60, 60});
+  GenerateOperands(300);
+
+  // Tiles of rows, each added one slice of coefficients at a time.
+  DotProductAccumulator accumulator(seal_context_);
+  constexpr size_t kRows = 100;
+  constexpr size_t kCoeffs = 1000;
+  for (size_t tile = 0; tile < cts_.size(); tile += kRows) {
+    accumulator.reserve_terms(kRows);
+    for (size_t c = 0; c < POLY_MODULUS_DEGREE; c += kCoeffs) {
+      const size_t c_end = std::min<size_t>(POLY_MODULUS_DEGREE, c + kCoeffs);
+      for (size_t i = tile; i < tile + kRows; ++i) {
+        accumulator.multiply_add(cts_[i], pts_[i].data(), c, c_end);
+      }
+    }
+  }
+  Ciphertext result;
+  accumulator.get_result(result);
+
+  ExpectSameCiphertext(result, ExpectedResult());
+}
+
+TEST_F(DotProductTest, TestReset) {
+  SetUpContext({36, 36, 37});
+  GenerateOperands(4);
+
+  DotProductAccumulator accumulator(seal_context_);
+  accumulator.multiply_add(cts_[0], pts_[0]);
+  accumulator.reset();
+  for (size_t i = 0; i < cts_.size(); ++i) {
+    accumulator.multiply_add(cts_[i], pts_[i]);
+  }
+  Ciphertext result;
+  accumulator.get_result(result);
+
+  ExpectSameCiphertext(result, ExpectedResult());
+}
+
+TEST_F(DotProductTest, TestRejectsCoefficientForm) {
+  SetUpContext({36, 36, 37});
+  GenerateOperands(1);
+  Ciphertext ct;
+  evaluator_->transform_from_ntt(cts_[0], ct);
+
+  DotProductAccumulator accumulator(seal_context_);
+  EXPECT_THROW(accumulator.multiply_add(ct, pts_[0]), std::invalid_argument);
+}
+
+}  // namespace
+}  // namespace pir
@@ -0,0 +1,46 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/index_planner.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace pir {
+
+IndexPlanner::IndexPlanner(const PIRParameters& params)
+    : items_per_plaintext_(std::max<uint32_t>(params.items_per_plaintext(), 1)),
+      bytes_per_item_(params.bytes_per_item()),
+      dimensions_(params.dimensions().begin(), params.dimensions().end()),
+      dimensions_sum_(
+          std::accumulate(dimensions_.begin(), dimensions_.end(), size_t{0})) {}
+
+void IndexPlanner::calculate_indices(uint32_t index,
+                                     vector<uint32_t>& indices) const {
+  uint32_t pt_index = plaintext_index(index);
+  indices.resize(dimensions_.size());
+  for (size_t i = dimensions_.size(); i-- > 0;) {
+    indices[i] = pt_index % dimensions_[i];
+    pt_index = pt_index / dimensions_[i];
+  }
+}
+
+vector<uint32_t> IndexPlanner::calculate_indices(uint32_t index) const {
+  vector<uint32_t> indices;
+  calculate_indices(index, indices);
+  return indices;
+}
+
+}  // namespace pir
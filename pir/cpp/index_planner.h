@@ -0,0 +1,97 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PIR_INDEX_PLANNER_H_
+#define PIR_INDEX_PLANNER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "pir/proto/payload.pb.h"
+
+namespace pir {
+
+using std::size_t;
+using std::vector;
+
+/**
+ * Maps item indexes to where the items live in the multi-dimensional database
+ * representation: the position of their plaintext along each dimension, and
+ * their offset within the plaintext. Only needs the PIR parameters, so unlike
+ * PIRDatabase it can be used without any SEAL context, and it is cheap enough
+ * to build once and keep for the lifetime of a client, server or database.
+ */
+class IndexPlanner {
+ public:
+  /**
+   * Creates a planner for the layout given by the parameters. The parameters
+   * are not referenced after construction.
+   * @param[in] params PIR parameters.
+   */
+  explicit IndexPlanner(const PIRParameters& params);
+
+  /**
+   * Index of the plaintext holding an item, in the flat representation.
+   */
+  uint32_t plaintext_index(uint32_t index) const {
+    return index / items_per_plaintext_;
+  }
+
+  /**
+   * Writes the position of the plaintext holding an item along each dimension
+   * to indices. Doesn't allocate if indices already has room for them.
+   * @param[in] index Item index in the database.
+   * @param[out] indices One index per dimension.
+   */
+  void calculate_indices(uint32_t index, vector<uint32_t>& indices) const;
+
+  /**
+   * Returns the position of the plaintext holding an item along each
+   * dimension.
+   * @param[in] index Item index in the database.
+   */
+  vector<uint32_t> calculate_indices(uint32_t index) const;
+
+  /**
+   * Calculate the offset of an item within a plaintext.
+   * @param[in] index Item index in the database
+   * @returns Offset in bytes from start of the plaintext that contains item.
+   */
+  size_t calculate_item_offset(uint32_t index) const {
+    return static_cast<size_t>(index % items_per_plaintext_) * bytes_per_item_;
+  }
+
+  /**
+   * Size of each dimension.
+   */
+  const vector<uint32_t>& dimensions() const { return dimensions_; }
+
+  /**
+   * Sum of the sizes of all dimensions, which is the length of the selection
+   * vector of a query.
+   */
+  size_t dimensions_sum() const { return dimensions_sum_; }
+
+ private:
+  uint32_t items_per_plaintext_;
+  uint32_t bytes_per_item_;
+  vector<uint32_t> dimensions_;
+  size_t dimensions_sum_;
+};
+
+}  // namespace pir
+
+#endif  // PIR_INDEX_PLANNER_H_
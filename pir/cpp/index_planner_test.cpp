@@ -0,0 +1,80 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/index_planner.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "pir/cpp/parameters.h"
+
+namespace pir {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+
+TEST(IndexPlannerTest, TestCalculateIndices) {
+  PIRParameters params;
+  params.set_items_per_plaintext(3);
+  params.set_bytes_per_item(10);
+  params.add_dimensions(4);
+  params.add_dimensions(5);
+  IndexPlanner planner(params);
+
+  EXPECT_THAT(planner.dimensions(), ElementsAre(4, 5));
+  EXPECT_THAT(planner.dimensions_sum(), Eq(9u));
+  // Item 38 is in plaintext 12, at row 2 and column 2.
+  EXPECT_THAT(planner.plaintext_index(38), Eq(12u));
+  EXPECT_THAT(planner.calculate_indices(38), ElementsAre(2, 2));
+  EXPECT_THAT(planner.calculate_item_offset(38), Eq(20u));
+  EXPECT_THAT(planner.calculate_item_offset(39), Eq(0u));
+}
+
+TEST(IndexPlannerTest, TestCalculateIndicesReusesOutput) {
+  PIRParameters params;
+  params.set_items_per_plaintext(1);
+  params.add_dimensions(3);
+  params.add_dimensions(3);
+  params.add_dimensions(3);
+  IndexPlanner planner(params);
+
+  vector<uint32_t> indices;
+  planner.calculate_indices(14, indices);
+  EXPECT_THAT(indices, ElementsAre(1, 1, 2));
+  const auto* data = indices.data();
+  planner.calculate_indices(26, indices);
+  EXPECT_THAT(indices, ElementsAre(2, 2, 2));
+  EXPECT_THAT(indices.data(), Eq(data));
+}
+
+TEST(IndexPlannerTest, TestIndicesRoundTrip) {
+  auto params = CreatePIRParameters(5000, 64, 3).ValueOrDie();
+  IndexPlanner planner(*params);
+  const auto& dims = planner.dimensions();
+  for (uint32_t index = 0; index < params->num_items(); index += 97) {
+    const auto indices = planner.calculate_indices(index);
+    uint32_t pt_index = 0;
+    for (size_t d = 0; d < dims.size(); ++d) {
+      ASSERT_LT(indices[d], dims[d]);
+      pt_index = pt_index * dims[d] + indices[d];
+    }
+    EXPECT_THAT(pt_index, Eq(planner.plaintext_index(index)));
+    EXPECT_THAT(planner.calculate_item_offset(index),
+                Eq((index % params->items_per_plaintext()) * 64));
+  }
+}
+
+}  // namespace
+}  // namespace pir
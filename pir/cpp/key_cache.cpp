@@ -0,0 +1,81 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/key_cache.h"
+
+#include <cstdint>
+
+#include "seal/util/blake2.h"
+
+namespace pir {
+
+namespace {
+
+constexpr size_t kDigestBytes = 32;
+
+void UpdateDigest(blake2b_state* state, const string& bytes) {
+  // Each part is prefixed with its length, so that moving bytes from one part
+  // to the other changes the digest.
+  const uint64_t size = bytes.size();
+  blake2b_update(state, &size, sizeof(size));
+  blake2b_update(state, bytes.data(), bytes.size());
+}
+
+}  // namespace
+
+string KeyDigest(const string& galois_keys, const string& relin_keys) {
+  blake2b_state state;
+  blake2b_init(&state, kDigestBytes);
+  UpdateDigest(&state, galois_keys);
+  UpdateDigest(&state, relin_keys);
+  string digest(kDigestBytes, '\0');
+  blake2b_final(&state, &digest[0], digest.size());
+  return digest;
+}
+
+KeyCache::KeyCache(size_t capacity) : capacity_(capacity) {}
+
+std::shared_ptr<const KeyCache::Keys> KeyCache::Lookup(const string& key_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key_id);
+  if (it == index_.end()) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void KeyCache::Insert(const string& key_id, std::shared_ptr<const Keys> keys) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key_id);
+  if (it != index_.end()) {
+    it->second->second = std::move(keys);
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  entries_.emplace_front(key_id, std::move(keys));
+  index_[key_id] = entries_.begin();
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+size_t KeyCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+}  // namespace pir
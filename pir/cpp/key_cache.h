@@ -0,0 +1,101 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PIR_KEY_CACHE_H_
+#define PIR_KEY_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "seal/seal.h"
+
+namespace pir {
+
+using std::string;
+
+/**
+ * Digest identifying a set of serialized keys, sent in Request.key_id. The
+ * client computes it over the keys it generated, and the server checks it
+ * against the keys it receives before caching them under it.
+ * @param[in] galois_keys Serialized Galois keys.
+ * @param[in] relin_keys Serialized relinearization keys, may be empty.
+ * @returns 32 byte BLAKE2b digest of both.
+ */
+string KeyDigest(const string& galois_keys, const string& relin_keys);
+
+/**
+ * Bounded cache of deserialized client keys, keyed by their digest. Clients
+ * send their keys along with the digest once, and only the digest in later
+ * requests, so the server neither receives nor deserializes the keys again.
+ * When full, the least recently used keys are evicted. Safe to use from
+ * several threads.
+ */
+class KeyCache {
+ public:
+  struct Keys {
+    seal::GaloisKeys galois_keys;
+    std::optional<seal::RelinKeys> relin_keys;
+  };
+
+  /**
+   * Creates an empty cache.
+   * @param[in] capacity Maximum number of key sets to keep.
+   */
+  explicit KeyCache(size_t capacity);
+
+  KeyCache(const KeyCache&) = delete;
+  KeyCache& operator=(const KeyCache&) = delete;
+
+  /**
+   * Returns the keys cached under key_id and marks them as most recently
+   * used, or nullptr if there are none.
+   */
+  std::shared_ptr<const Keys> Lookup(const string& key_id);
+
+  /**
+   * Caches keys under key_id, replacing any keys already there, and evicts
+   * the least recently used keys if the cache is over capacity.
+   */
+  void Insert(const string& key_id, std::shared_ptr<const Keys> keys);
+
+  /**
+   * Number of key sets currently cached.
+   */
+  size_t size() const;
+
+  /**
+   * Maximum number of key sets kept.
+   */
+  size_t capacity() const { return capacity_; }
+
+ private:
+  using Entry = std::pair<string, std::shared_ptr<const Keys>>;
+
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_;
+  std::unordered_map<string, std::list<Entry>::iterator> index_;
+};
+
+}  // namespace pir
+
+#endif  // PIR_KEY_CACHE_H_
@@ -0,0 +1,79 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/key_cache.h"
+
+#include <memory>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace pir {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsNull;
+using ::testing::Ne;
+
+std::shared_ptr<const KeyCache::Keys> MakeKeys() {
+  return std::make_shared<KeyCache::Keys>();
+}
+
+TEST(KeyCacheTest, TestLookup) {
+  KeyCache cache(2);
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  auto keys = MakeKeys();
+  cache.Insert("a", keys);
+  EXPECT_THAT(cache.Lookup("a"), Eq(keys));
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+  EXPECT_THAT(cache.size(), Eq(1u));
+}
+
+TEST(KeyCacheTest, TestEvictsLeastRecentlyUsed) {
+  KeyCache cache(2);
+  auto a = MakeKeys();
+  auto b = MakeKeys();
+  auto c = MakeKeys();
+  cache.Insert("a", a);
+  cache.Insert("b", b);
+  // Using a makes b the least recently used.
+  EXPECT_THAT(cache.Lookup("a"), Eq(a));
+  cache.Insert("c", c);
+  EXPECT_THAT(cache.size(), Eq(2u));
+  EXPECT_THAT(cache.Lookup("a"), Eq(a));
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+  EXPECT_THAT(cache.Lookup("c"), Eq(c));
+}
+
+TEST(KeyCacheTest, TestInsertReplaces) {
+  KeyCache cache(2);
+  auto a = MakeKeys();
+  auto b = MakeKeys();
+  cache.Insert("a", a);
+  cache.Insert("a", b);
+  EXPECT_THAT(cache.size(), Eq(1u));
+  EXPECT_THAT(cache.Lookup("a"), Eq(b));
+}
+
+TEST(KeyCacheTest, TestKeyDigest) {
+  const auto digest = KeyDigest("galois", "relin");
+  EXPECT_THAT(digest.size(), Eq(32u));
+  EXPECT_THAT(KeyDigest("galois", "relin"), Eq(digest));
+  EXPECT_THAT(KeyDigest("galois", ""), Ne(digest));
+  EXPECT_THAT(KeyDigest("galoisrelin", ""), Ne(KeyDigest("galois", "relin")));
+}
+
+}  // namespace
+}  // namespace pir
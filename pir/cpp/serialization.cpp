@@ -32,47 +32,122 @@ using std::string;
 using std::vector;
 
 StatusOr<vector<Ciphertext>> LoadCiphertexts(
-    const std::shared_ptr<seal::SEALContext>& sealctx,
-    const Ciphertexts& input) {
-  vector<Ciphertext> output(input.ct_size());
+    const std::shared_ptr<seal::SEALContext>& sealctx, const Ciphertexts& input,
+    seal::MemoryPoolHandle pool) {
+  vector<Ciphertext> output;
+  output.reserve(input.ct_size());
   for (int idx = 0; idx < input.ct_size(); ++idx) {
-    ASSIGN_OR_RETURN(output[idx],
-                     SEALDeserialize<Ciphertext>(sealctx, input.ct(idx)));
+    // Loaded in place rather than through SEALDeserialize, since copying or
+    // moving the result there would lose the pool it was allocated from.
+    output.emplace_back(pool);
+    RETURN_IF_ERROR(SEALLoad(sealctx, input.ct(idx), &output.back()));
   }
 
   return output;
 }
 
-Status SaveCiphertexts(const vector<Ciphertext>& ciphertexts,
-                       Ciphertexts* output) {
+StatusOr<seal::compr_mode_type> ComprMode(Compression compression) {
+  seal::compr_mode_type compr_mode;
+  switch (compression) {
+    case COMPRESSION_NONE:
+      compr_mode = seal::compr_mode_type::none;
+      break;
+    case COMPRESSION_DEFLATE:
+      compr_mode = seal::compr_mode_type::deflate;
+      break;
+    default:
+      return InvalidArgumentError("unknown compression " +
+                                  std::to_string(compression));
+  }
+  if (!seal::Serialization::IsSupportedComprMode(compr_mode)) {
+    return InvalidArgumentError("compression " + Compression_Name(compression) +
+                                " is not supported by this build of SEAL");
+  }
+  return compr_mode;
+}
+
+namespace {
+
+// Saves plain or seeded ciphertexts.
+template <class T>
+Status SaveCiphertextsImpl(const vector<T>& ciphertexts, Ciphertexts* output,
+                           seal::compr_mode_type compr_mode) {
   if (output == nullptr) {
     return InvalidArgumentError("output nullptr");
   }
 
   for (size_t idx = 0; idx < ciphertexts.size(); ++idx) {
     RETURN_IF_ERROR(
-        SEALSerialize<Ciphertext>(ciphertexts[idx], output->add_ct()));
+        SEALSerialize<T>(ciphertexts[idx], output->add_ct(), compr_mode));
   }
   return Status::OK;
 }
 
-Status SaveRequest(const vector<vector<Ciphertext>>& cts,
-                   const GaloisKeys& galois_keys, Request* request) {
+// Saves a request made of plain or seeded objects. relin_keys may be nullptr.
+template <class CT, class GK, class RK>
+Status SaveRequestImpl(const vector<vector<CT>>& cts, const GK& galois_keys,
+                       const RK* relin_keys, Request* request,
+                       const WireCompression& compression) {
+  if (request == nullptr) {
+    return InvalidArgumentError("request nullptr");
+  }
+  ASSIGN_OR_RETURN(auto query_compr_mode, ComprMode(compression.query));
+  ASSIGN_OR_RETURN(auto keys_compr_mode, ComprMode(compression.keys));
   for (const auto& ct : cts) {
-    RETURN_IF_ERROR(SaveCiphertexts(ct, request->add_query()));
+    RETURN_IF_ERROR(
+        SaveCiphertextsImpl(ct, request->add_query(), query_compr_mode));
   }
-  RETURN_IF_ERROR(
-      SEALSerialize<GaloisKeys>(galois_keys, request->mutable_galois_keys()));
+  RETURN_IF_ERROR(SEALSerialize<GK>(
+      galois_keys, request->mutable_galois_keys(), keys_compr_mode));
+  if (relin_keys != nullptr) {
+    RETURN_IF_ERROR(SEALSerialize<RK>(
+        *relin_keys, request->mutable_relin_keys(), keys_compr_mode));
+  }
+  request->set_response_compression(compression.response);
   return Status::OK;
 }
 
+}  // namespace
+
+Status SaveCiphertexts(const vector<Ciphertext>& ciphertexts,
+                       Ciphertexts* output, seal::compr_mode_type compr_mode) {
+  return SaveCiphertextsImpl(ciphertexts, output, compr_mode);
+}
+
+Status SaveCiphertexts(
+    const vector<seal::Serializable<Ciphertext>>& ciphertexts,
+    Ciphertexts* output, seal::compr_mode_type compr_mode) {
+  return SaveCiphertextsImpl(ciphertexts, output, compr_mode);
+}
+
+Status SaveRequest(const vector<vector<Ciphertext>>& cts,
+                   const GaloisKeys& galois_keys, Request* request,
+                   const WireCompression& compression) {
+  return SaveRequestImpl<Ciphertext, GaloisKeys, RelinKeys>(
+      cts, galois_keys, nullptr, request, compression);
+}
+
 Status SaveRequest(const vector<vector<Ciphertext>>& cts,
                    const seal::GaloisKeys& galois_keys,
-                   const seal::RelinKeys& relin_keys, Request* request) {
-  RETURN_IF_ERROR(SaveRequest(cts, galois_keys, request));
-  RETURN_IF_ERROR(
-      SEALSerialize<RelinKeys>(relin_keys, request->mutable_relin_keys()));
-  return Status::OK;
+                   const seal::RelinKeys& relin_keys, Request* request,
+                   const WireCompression& compression) {
+  return SaveRequestImpl(cts, galois_keys, &relin_keys, request, compression);
+}
+
+Status SaveRequest(const vector<vector<seal::Serializable<Ciphertext>>>& cts,
+                   const seal::Serializable<GaloisKeys>& galois_keys,
+                   Request* request, const WireCompression& compression) {
+  return SaveRequestImpl<seal::Serializable<Ciphertext>,
+                         seal::Serializable<GaloisKeys>,
+                         seal::Serializable<RelinKeys>>(
+      cts, galois_keys, nullptr, request, compression);
+}
+
+Status SaveRequest(const vector<vector<seal::Serializable<Ciphertext>>>& cts,
+                   const seal::Serializable<GaloisKeys>& galois_keys,
+                   const seal::Serializable<RelinKeys>& relin_keys,
+                   Request* request, const WireCompression& compression) {
+  return SaveRequestImpl(cts, galois_keys, &relin_keys, request, compression);
 }
 
 };  // namespace pir
@@ -19,6 +19,7 @@
 
 #include <string>
 
+#include "pir/cpp/utils.h"
 #include "pir/proto/payload.pb.h"
 #include "seal/seal.h"
 #include "util/canonical_errors.h"
@@ -37,20 +38,47 @@ using std::shared_ptr;
 using std::string;
 using std::vector;
 
+/**
+ * Compression applied to each kind of SEAL object in a request and its
+ * response. Compression saves bytes on the wire at the cost of CPU time on
+ * both ends, see BM_Compression in benchmark.cpp. Random looking ciphertexts
+ * compress far less than the plain bit count of their coefficients suggests.
+ */
+struct WireCompression {
+  // Query ciphertexts.
+  Compression query = COMPRESSION_NONE;
+  // Galois and relinearization keys.
+  Compression keys = COMPRESSION_NONE;
+  // Reply ciphertexts, asked of the server through the request.
+  Compression response = COMPRESSION_NONE;
+};
+
+/**
+ * Returns the SEAL compression mode for a wire compression.
+ * @returns InvalidArgument if the compression is unknown, or if SEAL was built
+ *without support for it.
+ **/
+StatusOr<seal::compr_mode_type> ComprMode(Compression compression);
+
 /**
  * Decodes and loads a PIR Ciphertext.
  * @param[in] The SEAL context, for buffer allocations.
  * @param[in] The encoded ciphertext.
+ * @param[in] Memory pool the ciphertexts are allocated from.
  * @returns InvalidArgument if the decoding fails.
  **/
-StatusOr<vector<Ciphertext>> LoadCiphertexts(const shared_ptr<SEALContext>& ctx,
-                                             const Ciphertexts& encoded);
+StatusOr<vector<Ciphertext>> LoadCiphertexts(
+    const shared_ptr<SEALContext>& ctx, const Ciphertexts& encoded,
+    seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
 
 /**
  * Saves the Ciphertexts to a protobuffer.
+ * @param[in] compr_mode Compression to apply to each ciphertext.
  * @returns InvalidArgument if the encoding fails
  **/
-Status SaveCiphertexts(const vector<Ciphertext>& buff, Ciphertexts* output);
+Status SaveCiphertexts(
+    const vector<Ciphertext>& buff, Ciphertexts* output,
+    seal::compr_mode_type compr_mode = seal::compr_mode_type::none);
 
 /**
  * Shortcut to save response data to a protocol buffer based on a list of
@@ -58,10 +86,13 @@ Status SaveCiphertexts(const vector<Ciphertext>& buff, Ciphertexts* output);
  * @param[in] cts The list of Ciphertexts in the query.
  * @param[in] galois_keys The Galois Keys to encode in the protocol buffer.
  * @param[out] request Point to the request protocol buffer to fill in.
+ * @param[in] compression Compression to apply to the request, and to ask of
+ *   the response.
  * @returns InvalidArgument if the encoding fails.
  */
 Status SaveRequest(const vector<vector<Ciphertext>>& cts,
-                   const seal::GaloisKeys& galois_keys, Request* request);
+                   const seal::GaloisKeys& galois_keys, Request* request,
+                   const WireCompression& compression = WireCompression());
 
 /**
  * Shortcut to save response data to a protocol buffer based on a list of
@@ -70,54 +101,126 @@ Status SaveRequest(const vector<vector<Ciphertext>>& cts,
  * @param[in] galois_keys The Galois Keys to encode in the protocol buffer.
  * @param[in] relin_keys The relinearization keys to encode.
  * @param[out] request Point to the request protocol buffer to fill in.
+ * @param[in] compression Compression to apply to the request, and to ask of
+ *   the response.
  * @returns InvalidArgument if the encoding fails.
  */
 Status SaveRequest(const vector<vector<Ciphertext>>& cts,
                    const seal::GaloisKeys& galois_keys,
-                   const seal::RelinKeys& relin_keys, Request* request);
+                   const seal::RelinKeys& relin_keys, Request* request,
+                   const WireCompression& compression = WireCompression());
 
 /**
- * Saves a SEAL object to a string.
+ * Saves seeded Ciphertexts, such as those from Encryptor::encrypt_symmetric,
+ * to a protobuffer. Only a seed is stored in place of the uniformly random
+ * half of each ciphertext. LoadCiphertexts loads them like any other.
+ * @param[in] compr_mode Compression to apply to each ciphertext.
+ * @returns InvalidArgument if the encoding fails
+ **/
+Status SaveCiphertexts(
+    const vector<seal::Serializable<Ciphertext>>& buff, Ciphertexts* output,
+    seal::compr_mode_type compr_mode = seal::compr_mode_type::none);
+
+/**
+ * Shortcut to save a request made of seeded Ciphertexts and seeded GaloisKeys,
+ * such as those from KeyGenerator::galois_keys, in their compact form.
+ * @param[in] cts The list of Ciphertexts in the query.
+ * @param[in] galois_keys The Galois Keys to encode in the protocol buffer.
+ * @param[out] request Point to the request protocol buffer to fill in.
+ * @param[in] compression Compression to apply to the request, and to ask of
+ *   the response.
+ * @returns InvalidArgument if the encoding fails.
+ */
+Status SaveRequest(const vector<vector<seal::Serializable<Ciphertext>>>& cts,
+                   const seal::Serializable<seal::GaloisKeys>& galois_keys,
+                   Request* request,
+                   const WireCompression& compression = WireCompression());
+
+/**
+ * Shortcut to save a request made of seeded Ciphertexts, seeded GaloisKeys
+ * and seeded relinearization keys in their compact form.
+ * @param[in] cts The list of Ciphertexts in the query.
+ * @param[in] galois_keys The Galois Keys to encode in the protocol buffer.
+ * @param[in] relin_keys The relinearization keys to encode.
+ * @param[out] request Point to the request protocol buffer to fill in.
+ * @param[in] compression Compression to apply to the request, and to ask of
+ *   the response.
+ * @returns InvalidArgument if the encoding fails.
+ */
+Status SaveRequest(const vector<vector<seal::Serializable<Ciphertext>>>& cts,
+                   const seal::Serializable<seal::GaloisKeys>& galois_keys,
+                   const seal::Serializable<seal::RelinKeys>& relin_keys,
+                   Request* request,
+                   const WireCompression& compression = WireCompression());
+
+/**
+ * Saves a SEAL object to a string, such as a protocol buffer field. The string
+ * is sized with save_size and the object saved straight into it, without
+ * going through an intermediate stream.
  * Compatible SEAL types: Ciphertext, Plaintext, SecretKey, PublicKey,
- *GaloisKeys, RelinKeys.
+ *GaloisKeys, RelinKeys, and Serializable wrappers of them.
+ * @param[in] compr_mode Compression to apply, none by default.
  * @returns InternalError if the encoding fails.
  **/
 template <class T>
-Status SEALSerialize(const T& sealobj, string* output) {
+Status SEALSerialize(
+    const T& sealobj, string* output,
+    seal::compr_mode_type compr_mode = seal::compr_mode_type::none) {
   if (output == nullptr) {
     return InvalidArgumentError("output nullptr");
   }
-  std::stringstream stream;
 
   try {
-    sealobj.save(stream);
+    // save_size is exact without compression, and an upper bound with it.
+    // The capacity of that bound is kept after trimming to the compressed
+    // size: the output is usually a proto field that is sent and dropped,
+    // and shrinking it would copy the whole object once more.
+    output->resize(static_cast<size_t>(sealobj.save_size(compr_mode)));
+    auto size = sealobj.save(reinterpret_cast<seal::SEAL_BYTE*>(&(*output)[0]),
+                             output->size(), compr_mode);
+    output->resize(static_cast<size_t>(size));
   } catch (const std::exception& e) {
     return InternalError(e.what());
   }
 
-  *output = stream.str();
   return Status::OK;
 }
 
 /**
- * Loads a SEAL object from a string.
+ * Loads a SEAL object in place from a string, such as a protocol buffer
+ * field, without copying the string first.
  * Compatible SEAL types: Ciphertext, Plaintext, SecretKey, PublicKey,
  *GaloisKeys, RelinKeys.
  * @returns InvalidArgument if the decoding fails.
  **/
 template <class T>
-StatusOr<T> SEALDeserialize(const shared_ptr<SEALContext>& sealctx,
-                            const string& in) {
-  T out;
+Status SEALLoad(const shared_ptr<SEALContext>& sealctx, const string& in,
+                T* out) {
+  if (out == nullptr) {
+    return InvalidArgumentError("output nullptr");
+  }
 
   try {
-    std::stringstream stream;
-    stream << in;
-    out.load(sealctx, stream);
+    out->load(sealctx, reinterpret_cast<const seal::SEAL_BYTE*>(in.data()),
+              in.size());
   } catch (const std::exception& e) {
     return InvalidArgumentError(e.what());
   }
 
+  return Status::OK;
+}
+
+/**
+ * Loads a SEAL object from a string.
+ * Compatible SEAL types: Ciphertext, Plaintext, SecretKey, PublicKey,
+ *GaloisKeys, RelinKeys.
+ * @returns InvalidArgument if the decoding fails.
+ **/
+template <class T>
+StatusOr<T> SEALDeserialize(const shared_ptr<SEALContext>& sealctx,
+                            const string& in) {
+  T out;
+  RETURN_IF_ERROR(SEALLoad(sealctx, in, &out));
   return out;
 }
 
@@ -131,9 +234,7 @@ StatusOr<T> SEALDeserialize(const string& in) {
   T out;
 
   try {
-    std::stringstream stream;
-    stream << in;
-    out.load(stream);
+    out.load(reinterpret_cast<const seal::SEAL_BYTE*>(in.data()), in.size());
   } catch (const std::exception& e) {
     return InvalidArgumentError(e.what());
   }
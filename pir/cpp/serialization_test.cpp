@@ -175,6 +175,95 @@ TEST_F(PIRSerializationTest, TestRequestSerialization_ShortcutWithRelin) {
   // Can't really check if the relin keys are valid. Just assume it's ok here.
 }
 
+TEST_F(PIRSerializationTest, TestRequestSerialization_Compressed) {
+  int64_t value = 987654321;
+  Plaintext pt, reloaded_pt;
+  context_->Encoder()->encode(value, pt);
+  vector<Ciphertext> ct(1);
+  encryptor_->encrypt(pt, ct[0]);
+
+  auto keygen_ = make_unique<KeyGenerator>(context_->SEALContext());
+  auto elts = generate_galois_elts(DEFAULT_POLY_MODULUS_DEGREE);
+  GaloisKeys gal_keys = keygen_->galois_keys_local(elts);
+
+  Request plain_proto;
+  ASSERT_OK(SaveRequest({ct}, gal_keys, &plain_proto));
+  EXPECT_EQ(plain_proto.response_compression(), COMPRESSION_NONE);
+
+  WireCompression compression;
+  compression.query = COMPRESSION_DEFLATE;
+  compression.keys = COMPRESSION_DEFLATE;
+  compression.response = COMPRESSION_DEFLATE;
+  Request request_proto;
+  ASSERT_OK(SaveRequest({ct}, gal_keys, &request_proto, compression));
+  EXPECT_EQ(request_proto.response_compression(), COMPRESSION_DEFLATE);
+  EXPECT_LT(request_proto.query(0).ct(0).size(),
+            plain_proto.query(0).ct(0).size());
+  EXPECT_LT(request_proto.galois_keys().size(),
+            plain_proto.galois_keys().size());
+
+  ASSIGN_OR_FAIL(auto request, LoadCiphertexts(context_->SEALContext(),
+                                               request_proto.query(0)));
+  ASSERT_EQ(request.size(), 1);
+  decryptor_->decrypt(request[0], reloaded_pt);
+  EXPECT_THAT(reloaded_pt, pt);
+
+  ASSIGN_OR_FAIL(auto gal_keys_post,
+                 SEALDeserialize<GaloisKeys>(context_->SEALContext(),
+                                             request_proto.galois_keys()));
+  for (const auto& e : elts) {
+    ASSERT_TRUE(gal_keys_post.has_key(e));
+  }
+}
+
+TEST_F(PIRSerializationTest, TestComprMode) {
+  ASSIGN_OR_FAIL(auto none, ComprMode(COMPRESSION_NONE));
+  EXPECT_EQ(none, compr_mode_type::none);
+  ASSIGN_OR_FAIL(auto deflate, ComprMode(COMPRESSION_DEFLATE));
+  EXPECT_EQ(deflate, compr_mode_type::deflate);
+
+  auto unknown = ComprMode(static_cast<Compression>(42));
+  EXPECT_EQ(unknown.status().code(),
+            private_join_and_compute::StatusCode::kInvalidArgument);
+}
+
+TEST_F(PIRSerializationTest, TestSerializeMatchesStream) {
+  int64_t value = 987654321;
+  Plaintext pt;
+  context_->Encoder()->encode(value, pt);
+  Ciphertext ct;
+  encryptor_->encrypt(pt, ct);
+
+  for (auto compr_mode : {compr_mode_type::none, compr_mode_type::deflate}) {
+    std::stringstream stream;
+    ct.save(stream, compr_mode);
+    std::string serial;
+    ASSERT_OK(SEALSerialize(ct, &serial, compr_mode));
+    // Compressed output is trimmed from the save_size bound to its real size.
+    EXPECT_EQ(serial, stream.str());
+  }
+}
+
+TEST_F(PIRSerializationTest, TestSEALLoad) {
+  int64_t value = 987654321;
+  Plaintext pt, reloaded_pt;
+  context_->Encoder()->encode(value, pt);
+  Ciphertext ct;
+  encryptor_->encrypt(pt, ct);
+  std::string serial;
+  ASSERT_OK(SEALSerialize(ct, &serial));
+
+  Ciphertext reloaded;
+  ASSERT_OK(SEALLoad(context_->SEALContext(), serial, &reloaded));
+  decryptor_->decrypt(reloaded, reloaded_pt);
+  EXPECT_THAT(reloaded_pt, pt);
+
+  auto status =
+      SEALLoad(context_->SEALContext(), serial.substr(0, 10), &reloaded);
+  EXPECT_EQ(status.code(),
+            private_join_and_compute::StatusCode::kInvalidArgument);
+}
+
 TEST_F(PIRSerializationTest, TestEncryptionParamsSerialization) {
   auto params = GenerateEncryptionParams();
   std::string serial;
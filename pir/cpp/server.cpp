@@ -15,10 +15,15 @@
 //
 #include "pir/cpp/server.h"
 
+#include <algorithm>
+
 #include "absl/memory/memory.h"
+#include "pir/cpp/thread_pool.h"
 #include "pir/cpp/utils.h"
 #include "seal/seal.h"
+#include "seal/util/ntt.h"
 #include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintcore.h"
 #include "util/canonical_errors.h"
 #include "util/status_macros.h"
 #include "util/statusor.h"
@@ -27,6 +32,7 @@ namespace pir {
 
 using ::private_join_and_compute::InternalError;
 using ::private_join_and_compute::InvalidArgumentError;
+using ::private_join_and_compute::NotFoundError;
 using ::private_join_and_compute::Status;
 using ::private_join_and_compute::StatusOr;
 using ::seal::GaloisKeys;
@@ -46,62 +52,268 @@ StatusOr<std::unique_ptr<PIRServer>> PIRServer::Create(
   return absl::WrapUnique(new PIRServer(std::move(context), db));
 }
 
+StatusOr<std::shared_ptr<const KeyCache::Keys>> PIRServer::loadKeys(
+    const Request& request) const {
+  const bool has_keys = !request.galois_keys().empty();
+  if (!request.key_id().empty() && key_cache_ != nullptr) {
+    // Keys sent along with a cached key_id are not looked at, so hits don't
+    // pay for hashing them.
+    if (auto keys = key_cache_->Lookup(request.key_id()); keys != nullptr) {
+      return keys;
+    }
+    if (!has_keys) {
+      return NotFoundError("No keys cached for key_id, keys must be resent");
+    }
+  }
+
+  // Keys are the largest part of a request, so they are loaded in place.
+  auto keys = std::make_shared<KeyCache::Keys>();
+  RETURN_IF_ERROR(SEALLoad(context_->SEALContext(), request.galois_keys(),
+                           &keys->galois_keys));
+  for (uint32_t galois_elt : context_->GaloisElements()) {
+    if (!keys->galois_keys.has_key(galois_elt)) {
+      return InvalidArgumentError("Missing Galois key for element " +
+                                  std::to_string(galois_elt));
+    }
+  }
+  if (!request.relin_keys().empty()) {
+    RETURN_IF_ERROR(SEALLoad(context_->SEALContext(), request.relin_keys(),
+                             &keys->relin_keys.emplace()));
+  }
+  if (!request.key_id().empty() && key_cache_ != nullptr) {
+    // Never cache keys under somebody else's digest.
+    if (request.key_id() !=
+        KeyDigest(request.galois_keys(), request.relin_keys())) {
+      return InvalidArgumentError("key_id does not match the keys sent");
+    }
+    key_cache_->Insert(request.key_id(), keys);
+  }
+  return std::shared_ptr<const KeyCache::Keys>(std::move(keys));
+}
+
 StatusOr<Response> PIRServer::ProcessRequest(const Request& request) const {
   Response response;
-  ASSIGN_OR_RETURN(auto galois_keys,
-                   SEALDeserialize<GaloisKeys>(context_->SEALContext(),
-                                               request.galois_keys()));
+  ASSIGN_OR_RETURN(auto keys, loadKeys(request));
+  const auto& galois_keys = keys->galois_keys;
+  const auto& relin_keys = keys->relin_keys;
 
-  const auto dimensions = context_->Params()->dimensions();
+  const auto& dimensions = context_->Planner().dimensions();
   const size_t dim_sum = context_->DimensionsSum();
 
-  optional<RelinKeys> relin_keys;
-  if (!request.relin_keys().empty()) {
-    ASSIGN_OR_RETURN(relin_keys,
-                     SEALDeserialize<RelinKeys>(context_->SEALContext(),
-                                                request.relin_keys()));
+  // All ciphertexts and temporaries of this request are allocated from a pool
+  // of its own, rather than from the global pool shared by every request. The
+  // memory is handed back as soon as the request is done, instead of being
+  // kept around by the global pool for the lifetime of the process.
+  auto pool = seal::MemoryPoolHandle::New();
+
+  const size_t num_queries = request.query_size();
+  vector<seal::Ciphertext> results;
+  if (fused_expansion_ && dimensions.size() == 1) {
+    // Each query is expanded straight into its product with the database, see
+    // set_fused_expansion.
+    results.resize(num_queries);
+    RETURN_IF_ERROR(ParallelFor(thread_pool_.get(), num_queries, [&](size_t i) {
+      ASSIGN_OR_RETURN(results[i],
+                       expandAndMultiply(request.query(i), galois_keys,
+                                         dim_sum, pool));
+      return Status::OK;
+    }));
+  } else {
+    // Expand all of the queries first, so that the database only has to be
+    // scanned once for the whole request. Queries are independent, so they
+    // are expanded concurrently if there is a thread pool.
+    vector<vector<seal::Ciphertext>> selection_vectors(num_queries);
+    RETURN_IF_ERROR(ParallelFor(thread_pool_.get(), num_queries, [&](size_t i) {
+      ASSIGN_OR_RETURN(
+          selection_vectors[i],
+          expandQuery(request.query(i), galois_keys, dim_sum, pool));
+      return Status::OK;
+    }));
+
+    ASSIGN_OR_RETURN(results,
+                     db_->multiply(selection_vectors,
+                                   relin_keys ? &relin_keys.value() : nullptr,
+                                   /*decryptor=*/nullptr, pool));
   }
 
-  for (const auto& query : request.query()) {
-    RETURN_IF_ERROR(processQuery(query, galois_keys, relin_keys, dim_sum,
-                                 response.add_reply()));
+  // Replies are compressed as the client asked, unless this build of SEAL
+  // cannot, in which case they are sent as they are.
+  auto compr_mode = seal::compr_mode_type::none;
+  auto compr_mode_or = ComprMode(request.response_compression());
+  if (compr_mode_or.ok()) {
+    compr_mode = compr_mode_or.ValueOrDie();
+    response.set_compression(request.response_compression());
   }
+
+  // Reply slots are allocated up front so that each one can be written from a
+  // different thread, keeping replies in the same order as the queries.
+  for (size_t i = 0; i < num_queries; ++i) {
+    response.add_reply();
+  }
+  RETURN_IF_ERROR(ParallelFor(thread_pool_.get(), num_queries, [&](size_t i) {
+    RETURN_IF_ERROR(compactResponse(results[i], pool));
+    return SaveCiphertexts(vector<seal::Ciphertext>{results[i]},
+                           response.mutable_reply(i), compr_mode);
+  }));
   return response;
 }
 
+Status PIRServer::compactResponse(seal::Ciphertext& ct,
+                                  seal::MemoryPoolHandle pool) const {
+  auto context_data = context_->SEALContext()->get_context_data(ct.parms_id());
+  if (context_data == nullptr) {
+    return InternalError("Response is not valid for the encryption parameters");
+  }
+
+  // Switching down to modulus q' scales the noise of the response by q'/q and
+  // adds a rounding error of at most (1 + |s|_1 + |s^2|_1 + ...) / 2, which
+  // for a ternary secret is below N^(size - 1). The response decrypts as long
+  // as its noise stays below q' / 2t. With at least one bit of noise budget
+  // left before switching, the scaled noise takes at most half of that, so the
+  // rounding error has to fit into the other half: q' > 4t * N^(size - 1).
+  // Switching away several primes rounds once per prime, but each rounding
+  // error is scaled down by the primes dropped after it, so together they
+  // stay below twice the last one: one more bit, however many primes go. The
+  // server can't see the noise budget, so response_noise_margin_ more bits
+  // are kept to cover responses with less budget left than assumed.
+  const auto& parms = context_data->parms();
+  const int log_n = ceil_log2(parms.poly_modulus_degree());
+  const int required_bits = parms.plain_modulus().bit_count() +
+                            static_cast<int>(ct.size() - 1) * log_n + 2 +
+                            response_noise_margin_;
+
+  // Bit counts are rounded up, so a modulus with one more bit is needed.
+  auto target = context_data;
+  for (auto next = target->next_context_data(); next != nullptr;
+       next = next->next_context_data()) {
+    const bool several_primes =
+        context_data->chain_index() - next->chain_index() > 1;
+    if (next->total_coeff_modulus_bit_count() - 1 <
+        required_bits + (several_primes ? 1 : 0)) {
+      break;
+    }
+    target = next;
+  }
+  if (target == context_data) {
+    return Status::OK;
+  }
+  try {
+    context_->Evaluator()->mod_switch_to_inplace(ct, target->parms_id(), pool);
+  } catch (const std::exception& e) {
+    return InternalError(e.what());
+  }
+  return Status::OK;
+}
+
 Status PIRServer::substitute_power_x_inplace(
-    seal::Ciphertext& ct, uint32_t power,
-    const seal::GaloisKeys& gal_keys) const {
+    seal::Ciphertext& ct, uint32_t power, const seal::GaloisKeys& gal_keys,
+    seal::MemoryPoolHandle pool) const {
   try {
-    context_->Evaluator()->apply_galois_inplace(ct, power, gal_keys);
+    context_->Evaluator()->apply_galois_inplace(ct, power, gal_keys, pool);
   } catch (const std::exception& e) {
     return InternalError(e.what());
   }
   return Status::OK;
 }
 
+void PIRServer::inverse_power_of_x_ntt(
+    uint32_t k, std::vector<std::uint64_t>& destination) const {
+  const auto context_data = context_->SEALContext()->first_context_data();
+  const auto& params = context_data->parms();
+  const auto poly_modulus_degree = params.poly_modulus_degree();
+  const auto coeff_mod_count = params.coeff_modulus().size();
+
+  // x^(-k) = x^(2N - k), and x^N = -1.
+  const uint32_t index =
+      ((poly_modulus_degree << 1) - (k % (poly_modulus_degree << 1))) %
+      (poly_modulus_degree << 1);
+  destination.assign(coeff_mod_count * poly_modulus_degree, 0);
+  for (size_t j = 0; j < coeff_mod_count; j++) {
+    uint64_t* limb = destination.data() + (j * poly_modulus_degree);
+    if (index < poly_modulus_degree) {
+      limb[index] = 1;
+    } else {
+      limb[index - poly_modulus_degree] = params.coeff_modulus()[j].value() - 1;
+    }
+    seal::util::ntt_negacyclic_harvey(limb,
+                                      context_data->small_ntt_tables()[j]);
+  }
+}
+
+void PIRServer::precomputeInversePowersOfX() const {
+  // Powers of 1/x used by the expansion, see oblivious_expansion.
+  const uint32_t poly_modulus_degree =
+      context_->EncryptionParams().poly_modulus_degree();
+  for (uint32_t two_power_j = 1; two_power_j < poly_modulus_degree;
+       two_power_j <<= 1) {
+    for (uint32_t k : {two_power_j, poly_modulus_degree + two_power_j}) {
+      inverse_power_of_x_ntt(k, inverse_powers_of_x_ntt_[k]);
+    }
+  }
+}
+
 void PIRServer::multiply_inverse_power_of_x(
     const seal::Ciphertext& encrypted, uint32_t k,
-    seal::Ciphertext& destination) const {
+    seal::Ciphertext& destination, seal::MemoryPoolHandle pool) const {
   // This has to get the actual params from the SEALContext. Using just the
   // params from PIR doesn't work.
   const auto& params = context_->SEALContext()->first_context_data()->parms();
   const auto poly_modulus_degree = params.poly_modulus_degree();
   const auto coeff_mod_count = params.coeff_modulus().size();
 
+  if (&destination != &encrypted) {
+    // Every coefficient is written below, so only the shape is copied.
+    destination.resize(context_->SEALContext(), encrypted.parms_id(),
+                       encrypted.size());
+    destination.is_ntt_form() = encrypted.is_ntt_form();
+  }
+
+  if (encrypted.is_ntt_form()) {
+    // In NTT form multiplying by a monomial is a pointwise product with its
+    // NTT, which also works in place.
+    std::call_once(inverse_powers_of_x_ntt_once_,
+                   [this]() { precomputeInversePowersOfX(); });
+    std::vector<uint64_t> computed;
+    const std::vector<uint64_t>* monomial;
+    auto it = inverse_powers_of_x_ntt_.find(k % (poly_modulus_degree << 1));
+    if (it != inverse_powers_of_x_ntt_.end()) {
+      monomial = &it->second;
+    } else {
+      inverse_power_of_x_ntt(k, computed);
+      monomial = &computed;
+    }
+    for (size_t i = 0; i < encrypted.size(); i++) {
+      for (size_t j = 0; j < coeff_mod_count; j++) {
+        seal::util::dyadic_product_coeffmod(
+            encrypted.data(i) + (j * poly_modulus_degree),
+            monomial->data() + (j * poly_modulus_degree), poly_modulus_degree,
+            params.coeff_modulus()[j],
+            destination.data(i) + (j * poly_modulus_degree));
+      }
+    }
+    return;
+  }
+
   uint32_t index =
       ((poly_modulus_degree << 1) - k) % (poly_modulus_degree << 1);
 
-  // have to make a copy here
-  destination = encrypted;
-
+  // The shift can't be done in place, so when it is asked for each
+  // polynomial is shifted out of a copy of itself.
+  seal::util::Pointer<uint64_t> temp;
+  if (&destination == &encrypted) {
+    temp = seal::util::allocate_uint(poly_modulus_degree, pool);
+  }
   // Loop over polynomials in ciphertext
   for (size_t i = 0; i < encrypted.size(); i++) {
     // loop over each coefficient in polynomial
     for (size_t j = 0; j < coeff_mod_count; j++) {
+      const uint64_t* source = encrypted.data(i) + (j * poly_modulus_degree);
+      if (&destination == &encrypted) {
+        std::copy_n(source, poly_modulus_degree, temp.get());
+        source = temp.get();
+      }
       seal::util::negacyclic_shift_poly_coeffmod(
-          encrypted.data(i) + (j * poly_modulus_degree), poly_modulus_degree,
-          index, params.coeff_modulus()[j],
+          source, poly_modulus_degree, index, params.coeff_modulus()[j],
           destination.data(i) + (j * poly_modulus_degree));
     }
   }
@@ -109,7 +321,7 @@ void PIRServer::multiply_inverse_power_of_x(
 
 StatusOr<std::vector<seal::Ciphertext>> PIRServer::oblivious_expansion(
     const seal::Ciphertext& ct, const size_t num_items,
-    const seal::GaloisKeys& gal_keys) const {
+    const seal::GaloisKeys& gal_keys, seal::MemoryPoolHandle pool) const {
   const auto poly_modulus_degree =
       context_->EncryptionParams().poly_modulus_degree();
 
@@ -119,40 +331,124 @@ StatusOr<std::vector<seal::Ciphertext>> PIRServer::oblivious_expansion(
   }
 
   size_t logm = ceil_log2(num_items);
-  std::vector<seal::Ciphertext> results(next_power_two(num_items));
+  // Ciphertexts keep the pool they were constructed with when assigned to, but
+  // copies allocate from the global pool, so every ciphertext here is
+  // constructed with the pool first and then assigned.
+  std::vector<seal::Ciphertext> results;
+  results.reserve(num_items);
+  for (size_t i = 0; i < num_items; ++i) {
+    results.emplace_back(pool);
+  }
   results[0] = ct;
 
+  // Nodes of the same level of the expansion tree only read their own parent
+  // and write their own children, so they are expanded concurrently.
   for (size_t j = 0; j < logm; ++j) {
     const size_t two_power_j = (1 << j);
-    for (size_t k = 0; k < two_power_j; ++k) {
-      auto c0 = results[k];
-
-      RETURN_IF_ERROR(substitute_power_x_inplace(
-          c0, (poly_modulus_degree >> j) + 1, gal_keys));
-
-      // This essentially produces what the paper calls c1
-      multiply_inverse_power_of_x(results[k], two_power_j,
-                                  results[k + two_power_j]);
-
-      // Do the multiply by power of x after substitution operator to avoid
-      // having to do the substitution operator a second time, since it's about
-      // 20x slower. Except that now instead of multiplying by x^(-2^j) we have
-      // to do the substitution first ourselves, producing
-      // (x^(N/2^j + 1))^(-2^j) = 1/x^(2^j * (N/2^j + 1)) = 1/x^(N + 2^j)
-      seal::Ciphertext c1;
-      multiply_inverse_power_of_x(c0, poly_modulus_degree + two_power_j, c1);
-
-      context_->Evaluator()->add_inplace(results[k], c0);
-      context_->Evaluator()->add_inplace(results[k + two_power_j], c1);
-    }
+    RETURN_IF_ERROR(ParallelFor(thread_pool_.get(), two_power_j, [&](size_t k) {
+      auto* second_child =
+          k + two_power_j < num_items ? &results[k + two_power_j] : nullptr;
+      return expandNode(results[k], k, j, num_items, gal_keys, pool,
+                        second_child);
+    }));
   }
-  results.resize(num_items);
   return results;
 }
 
+Status PIRServer::expandNode(seal::Ciphertext& node, size_t k, size_t j,
+                             size_t num_items, const seal::GaloisKeys& gal_keys,
+                             seal::MemoryPoolHandle pool,
+                             seal::Ciphertext* second_child) const {
+  const auto poly_modulus_degree =
+      context_->EncryptionParams().poly_modulus_degree();
+  const size_t two_power_j = (1 << j);
+
+  if (k + two_power_j >= num_items) {
+    // The second child only leads to items past num_items, so it isn't
+    // computed. The part of the node that would go to it holds coefficients
+    // that are zero, so there is nothing for the substitution to cancel and
+    // doubling gives the same first child, without a key switch.
+    context_->Evaluator()->add_inplace(node, node);
+    return Status::OK;
+  }
+
+  seal::Ciphertext c0(pool);
+  c0 = node;
+
+  RETURN_IF_ERROR(substitute_power_x_inplace(
+      c0, (poly_modulus_degree >> j) + 1, gal_keys, pool));
+
+  // This essentially produces what the paper calls c1
+  multiply_inverse_power_of_x(node, two_power_j, *second_child, pool);
+
+  context_->Evaluator()->add_inplace(node, c0);
+
+  // Do the multiply by power of x after substitution operator to avoid
+  // having to do the substitution operator a second time, since it's about
+  // 20x slower. Except that now instead of multiplying by x^(-2^j) we have
+  // to do the substitution first ourselves, producing
+  // (x^(N/2^j + 1))^(-2^j) = 1/x^(2^j * (N/2^j + 1)) = 1/x^(N + 2^j)
+  // c0 isn't needed any more, so this is what the paper calls c1.
+  multiply_inverse_power_of_x(c0, poly_modulus_degree + two_power_j, c0,
+                              pool);
+  context_->Evaluator()->add_inplace(*second_child, c0);
+  return Status::OK;
+}
+
+Status PIRServer::expandDepthFirst(seal::Ciphertext& node, size_t k, size_t j,
+                                   size_t num_items,
+                                   const seal::GaloisKeys& gal_keys,
+                                   seal::MemoryPoolHandle pool,
+                                   const LeafSink& sink) const {
+  if (j == ceil_log2(num_items)) {
+    return sink(k, node);
+  }
+  // Only the second child of each level on the path to the current node is
+  // alive at any time, so memory grows with the depth of the tree.
+  seal::Ciphertext second_child(pool);
+  RETURN_IF_ERROR(
+      expandNode(node, k, j, num_items, gal_keys, pool, &second_child));
+  RETURN_IF_ERROR(
+      expandDepthFirst(node, k, j + 1, num_items, gal_keys, pool, sink));
+  if (k + (1 << j) >= num_items) {
+    return Status::OK;
+  }
+  return expandDepthFirst(second_child, k + (1 << j), j + 1, num_items,
+                          gal_keys, pool, sink);
+}
+
+StatusOr<seal::Ciphertext> PIRServer::expandAndMultiply(
+    const Ciphertexts& query_proto, const GaloisKeys& galois_keys,
+    size_t dim_sum, seal::MemoryPoolHandle pool) const {
+  const size_t poly_modulus_degree =
+      context_->EncryptionParams().poly_modulus_degree();
+  ASSIGN_OR_RETURN(auto query,
+                   LoadCiphertexts(context_->SEALContext(), query_proto, pool));
+  if (query.size() != dim_sum / poly_modulus_degree + 1) {
+    return InvalidArgumentError(
+        "Number of ciphertexts doesn't match number of items for oblivious "
+        "expansion.");
+  }
+
+  ASSIGN_OR_RETURN(auto accumulator, db_->accumulate(pool));
+  for (size_t c = 0; c < query.size(); ++c) {
+    const size_t offset = c * poly_modulus_degree;
+    const size_t num_items = std::min(poly_modulus_degree, dim_sum - offset);
+    if (num_items == 0) {
+      continue;
+    }
+    RETURN_IF_ERROR(expandDepthFirst(
+        query[c], 0, 0, num_items, galois_keys, pool,
+        [&](size_t k, const seal::Ciphertext& leaf) {
+          return accumulator->add(offset + k, leaf);
+        }));
+  }
+  return accumulator->result();
+}
+
 StatusOr<std::vector<seal::Ciphertext>> PIRServer::oblivious_expansion(
     const std::vector<seal::Ciphertext>& cts, size_t total_items,
-    const seal::GaloisKeys& gal_keys) const {
+    const seal::GaloisKeys& gal_keys, seal::MemoryPoolHandle pool) const {
   size_t poly_modulus_degree =
       context_->EncryptionParams().poly_modulus_degree();
 
@@ -162,41 +458,32 @@ StatusOr<std::vector<seal::Ciphertext>> PIRServer::oblivious_expansion(
         "expansion.");
   }
 
+  // Ciphertexts are expanded independently, so they are expanded concurrently
+  // and concatenated afterwards.
+  std::vector<std::vector<seal::Ciphertext>> expanded(cts.size());
+  RETURN_IF_ERROR(ParallelFor(thread_pool_.get(), cts.size(), [&](size_t c) {
+    const size_t num_items =
+        std::min(poly_modulus_degree, total_items - c * poly_modulus_degree);
+    ASSIGN_OR_RETURN(expanded[c],
+                     oblivious_expansion(cts[c], num_items, gal_keys, pool));
+    return Status::OK;
+  }));
+
   std::vector<seal::Ciphertext> results;
   results.reserve(total_items);
-  for (const auto& ct : cts) {
-    ASSIGN_OR_RETURN(
-        auto v, oblivious_expansion(
-                    ct, std::min(poly_modulus_degree, total_items), gal_keys));
+  for (auto& v : expanded) {
     results.insert(results.end(), std::make_move_iterator(v.begin()),
                    std::make_move_iterator(v.end()));
-    total_items -= poly_modulus_degree;
   }
   return results;
 }
 
-Status PIRServer::processQuery(const Ciphertexts& query_proto,
-                               const GaloisKeys& galois_keys,
-                               const optional<RelinKeys>& relin_keys,
-                               const size_t& dim_sum,
-                               Ciphertexts* output) const {
+StatusOr<vector<seal::Ciphertext>> PIRServer::expandQuery(
+    const Ciphertexts& query_proto, const GaloisKeys& galois_keys,
+    const size_t& dim_sum, seal::MemoryPoolHandle pool) const {
   ASSIGN_OR_RETURN(auto query,
-                   LoadCiphertexts(context_->SEALContext(), query_proto));
-
-  ASSIGN_OR_RETURN(auto selection_vector,
-                   oblivious_expansion(query, dim_sum, galois_keys));
-
-  seal::Ciphertext result;
-  if (relin_keys) {
-    ASSIGN_OR_RETURN(result,
-                     db_->multiply(selection_vector, &relin_keys.value()));
-  } else {
-    ASSIGN_OR_RETURN(result, db_->multiply(selection_vector));
-  }
-
-  RETURN_IF_ERROR(SaveCiphertexts(vector<seal::Ciphertext>{result}, output));
-
-  return Status::OK;
+                   LoadCiphertexts(context_->SEALContext(), query_proto, pool));
+  return oblivious_expansion(query, dim_sum, galois_keys, pool);
 }
 
 }  // namespace pir
@@ -17,11 +17,17 @@
 #ifndef PIR_SERVER_H_
 #define PIR_SERVER_H_
 
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <vector>
 
 #include "pir/cpp/context.h"
 #include "pir/cpp/database.h"
+#include "pir/cpp/key_cache.h"
 #include "pir/cpp/serialization.h"
+#include "pir/cpp/thread_pool.h"
 #include "seal/seal.h"
 #include "util/statusor.h"
 
@@ -32,6 +38,10 @@ using ::private_join_and_compute::StatusOr;
 using ::seal::GaloisKeys;
 using ::seal::RelinKeys;
 
+// Bits of noise budget kept to spare when responses are switched down the
+// modulus chain, see PIRServer::set_response_noise_margin.
+constexpr int DEFAULT_RESPONSE_NOISE_MARGIN = 1;
+
 class PIRServer {
  public:
   /**
@@ -44,15 +54,63 @@ class PIRServer {
       std::shared_ptr<PIRDatabase> database, shared_ptr<PIRParameters> params);
 
   /**
-   * Handles a client request.
+   * Handles a client request. Replies are switched down to the smallest
+   * coefficient modulus they can still be decrypted at, so they carry as few
+   * RNS limbs as possible.
+   * Replies are compressed as asked by request.response_compression if SEAL
+   * supports it, and sent uncompressed otherwise. response.compression tells
+   * which.
    * @param[in] request The PIR Payload
    * @returns InvalidArgument if the deserialization or encrypted operations
-   *fail
+   *fail, or NotFound if the request only has a key_id and no keys are cached
+   *under it, in which case the client should send its keys again.
    **/
   StatusOr<Response> ProcessRequest(const Request& request) const;
 
   PIRServer() = delete;
 
+  /**
+   * Sets a thread pool used to expand and serialize the queries of a request
+   * concurrently, and to spread the expansion of each query over several
+   * threads. Multiplication against the database uses the database's own
+   * pool, see PIRDatabase::set_thread_pool. The same pool can be given to
+   * both. If not set, or set to nullptr, queries are handled on the calling
+   * thread.
+   */
+  void set_thread_pool(std::shared_ptr<ThreadPool> pool) {
+    thread_pool_ = pool;
+  }
+
+  /**
+   * Sets a cache for client keys. Keys of requests that have a key_id are
+   * cached under it, and requests that only have a key_id use the cached
+   * keys. The same cache can be shared between servers using the same
+   * parameters. If not set, or set to nullptr, every request must carry its
+   * keys.
+   */
+  void set_key_cache(std::shared_ptr<KeyCache> cache) { key_cache_ = cache; }
+
+  /**
+   * If set, queries to one-dimensional databases are expanded depth first, and
+   * each selection vector ciphertext is multiplied into the result as soon as
+   * it is produced, instead of the whole selection vector being expanded
+   * first. This bounds the memory of a query to a couple of ciphertexts per
+   * level of the expansion tree, at the cost of scanning the database once
+   * per query rather than once per request, and of expanding each query on a
+   * single thread. Databases with more dimensions are not affected.
+   */
+  void set_fused_expansion(bool fused) { fused_expansion_ = fused; }
+
+  /**
+   * Sets a safety margin, in bits, kept when responses are switched down the
+   * modulus chain. The server can't see how much noise budget a response has
+   * left, so a larger margin keeps more of the modulus for responses that
+   * lost more of it than expected, such as those of very large databases.
+   * Zero switches as far as the noise estimate allows. Defaults to
+   * DEFAULT_RESPONSE_NOISE_MARGIN.
+   */
+  void set_response_noise_margin(int bits) { response_noise_margin_ = bits; }
+
   /**
    * Helper function to do the substitution operation on a ciphertext. If the
    * ciphertext is the encryption of polynomial p(x), then given power k, the
@@ -62,22 +120,34 @@ class PIRServer {
    * @param[in] gal_keys Galois keys used for automorphism. Must be generated by
    *   whoever encrypted the ciphertext using keygen, and must include the power
    *   being asked for.
+   * @param[in] pool Memory pool for temporaries.
    */
-  Status substitute_power_x_inplace(seal::Ciphertext& ct, std::uint32_t power,
-                                    const seal::GaloisKeys& gal_keys) const;
+  Status substitute_power_x_inplace(
+      seal::Ciphertext& ct, std::uint32_t power,
+      const seal::GaloisKeys& gal_keys,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 
   /**
    * Helper function to multiply a ciphertext by a given power of 1/x. As a
    * result plaintext is also multiplied by the same power of 1/x. For example,
    * if the ciphertext is the encryption of p(x) = 99x^5, and if the given k is
    * 3, then this results in p(x) * 1/x^3 = 99x^2.
+   *
+   * Works on ciphertexts in either coefficient or NTT form. In NTT form the
+   * ciphertext is multiplied with the NTT of x^(-k). Those of the powers used
+   * by oblivious_expansion are computed on the first call in NTT form and
+   * kept for later calls. destination may be the same
+   * ciphertext as encrypted.
    * @param[in] encrypted Ciphertext to take as input.
    * @param[in] k Power of 1/x to multiply.
    * @param[out] destination Output ciphertext after multiplying by power of x.
+   * @param[in] pool Memory pool for the scratch polynomial needed when
+   *    working in place.
    */
-  void multiply_inverse_power_of_x(const seal::Ciphertext& encrypted,
-                                   uint32_t k,
-                                   seal::Ciphertext& destination) const;
+  void multiply_inverse_power_of_x(
+      const seal::Ciphertext& encrypted, uint32_t k,
+      seal::Ciphertext& destination,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 
   /**
    * Performs an oblivious expansion on an input ciphertext to a vector of
@@ -101,14 +171,22 @@ class PIRServer {
    * where m is the smallest power of 2 greater than num_items. It is assumed
    * that the plaintext modulus will be changed to make this irrelevant.
    *
+   * Coefficients from num_items onwards must be zero, as they are in queries
+   * made by PIRClient. Parts of the expansion tree that only lead to them are
+   * skipped, so the number of substitutions grows with num_items rather than
+   * with m.
+   *
    * @param[in] ct The input ciphertext to expand.
    * @param[in] num_items The number of items to extract.
    * @param[in] gal_keys Galois keys supplied by the client.
+   * @param[in] pool Memory pool the results and temporaries are allocated
+   *   from.
    * @returns A vector of ciphertexts that are the expansion as described above.
    */
   StatusOr<std::vector<seal::Ciphertext>> oblivious_expansion(
       const seal::Ciphertext& ct, const size_t num_items,
-      const seal::GaloisKeys& gal_keys) const;
+      const seal::GaloisKeys& gal_keys,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 
   /**
    * Extension of oblivious_expansion to multiple ciphertexts. This allows
@@ -120,12 +198,15 @@ class PIRServer {
    * @param[in] cts List of ciphertexts to use as input to the expansion
    * @param[in] total_items Total number of ciphertexts after expansion
    * @param[in] gal_keys Galois keys supplied by the client
+   * @param[in] pool Memory pool the results and temporaries are allocated
+   *   from.
    * @returns A vector of ciphertexts that are the expansion of all of the input
    *   ciphertexts concatenated.
    */
   StatusOr<std::vector<seal::Ciphertext>> oblivious_expansion(
       const std::vector<seal::Ciphertext>& cts, const size_t total_items,
-      const seal::GaloisKeys& gal_keys) const;
+      const seal::GaloisKeys& gal_keys,
+      seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool()) const;
 
   // Just for testing: get the context
   PIRContext* Context() { return context_.get(); }
@@ -134,12 +215,67 @@ class PIRServer {
   PIRServer(std::unique_ptr<PIRContext> /*sealctx*/,
             std::shared_ptr<PIRDatabase> /*db*/);
 
-  Status processQuery(const Ciphertexts& query, const GaloisKeys& galois_keys,
-                      const optional<RelinKeys>& relin_keys,
-                      const size_t& dim_sum, Ciphertexts* output) const;
+  // Returns the keys of a request, from the key cache if possible.
+  StatusOr<std::shared_ptr<const KeyCache::Keys>> loadKeys(
+      const Request& request) const;
+
+  // Writes the NTT of x^(-k) for each coefficient modulus to destination.
+  void inverse_power_of_x_ntt(uint32_t k,
+                              std::vector<std::uint64_t>& destination) const;
+
+  // Fills inverse_powers_of_x_ntt_ with the powers used by the expansion.
+  void precomputeInversePowersOfX() const;
+
+  // Receives the leaves of a depth first expansion, with their index.
+  using LeafSink =
+      std::function<Status(size_t /*index*/, const seal::Ciphertext& /*leaf*/)>;
+
+  // Expands node k of level j of the expansion tree in place into its first
+  // child, and writes its second child to second_child if that child leads to
+  // any of the num_items items. Otherwise second_child may be nullptr.
+  Status expandNode(seal::Ciphertext& node, size_t k, size_t j,
+                    size_t num_items, const seal::GaloisKeys& gal_keys,
+                    seal::MemoryPoolHandle pool,
+                    seal::Ciphertext* second_child) const;
+
+  // Expands the subtree under node k of level j depth first, passing each leaf
+  // to sink as soon as it is produced. node is overwritten.
+  Status expandDepthFirst(seal::Ciphertext& node, size_t k, size_t j,
+                          size_t num_items, const seal::GaloisKeys& gal_keys,
+                          seal::MemoryPoolHandle pool,
+                          const LeafSink& sink) const;
+
+  // Loads a query, and expands and multiplies it with a one-dimensional
+  // database without materializing the selection vector.
+  StatusOr<seal::Ciphertext> expandAndMultiply(
+      const Ciphertexts& query, const GaloisKeys& galois_keys, size_t dim_sum,
+      seal::MemoryPoolHandle pool) const;
+
+  // Switches a response down to the lowest level of the modulus chain where
+  // the noise added by switching still leaves it decryptable, with
+  // response_noise_margin_ bits to spare.
+  Status compactResponse(seal::Ciphertext& ct,
+                         seal::MemoryPoolHandle pool) const;
+
+  // Loads a query and expands it into its selection vector, allocating from
+  // the given memory pool.
+  StatusOr<std::vector<seal::Ciphertext>> expandQuery(
+      const Ciphertexts& query, const GaloisKeys& galois_keys,
+      const size_t& dim_sum, seal::MemoryPoolHandle pool) const;
 
   std::unique_ptr<PIRContext> context_;
   std::shared_ptr<PIRDatabase> db_;
+  std::shared_ptr<ThreadPool> thread_pool_;
+  std::shared_ptr<KeyCache> key_cache_;
+  bool fused_expansion_ = false;
+  int response_noise_margin_ = DEFAULT_RESPONSE_NOISE_MARGIN;
+
+  // NTT of x^(-k) for the powers k used by the expansion, see
+  // multiply_inverse_power_of_x. Only built once a ciphertext in NTT form
+  // needs it, which the coefficient form expansion never does.
+  mutable std::once_flag inverse_powers_of_x_ntt_once_;
+  mutable std::map<uint32_t, std::vector<std::uint64_t>>
+      inverse_powers_of_x_ntt_;
 };
 
 }  // namespace pir
@@ -17,7 +17,9 @@
 #include "pir/cpp/server.h"
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #include "gmock/gmock.h"
@@ -65,9 +67,11 @@ class PIRServerTest : public ::testing::Test, public PIRTestingBase {
   void SetUp() { SetUpDB(10); }
 
   void SetUpDB(size_t dbsize, size_t dimensions = 1,
-               size_t elem_size = ELEM_SIZE, uint32_t plain_mod_bit_size = 20) {
+               size_t elem_size = ELEM_SIZE, uint32_t plain_mod_bit_size = 20,
+               bool preprocess_ntt = false) {
     SetUpParams(dbsize, elem_size, dimensions, POLY_MODULUS_DEGREE,
                 plain_mod_bit_size);
+    pir_params_->set_preprocess_ntt(preprocess_ntt);
     GenerateIntDB();
     SetUpSealTools();
 
@@ -103,6 +107,97 @@ TEST_F(PIRServerTest, TestProcessRequest_SingleCT) {
               Eq(int_db_[desired_index] * next_power_two(db_size_)));
 }
 
+TEST_F(PIRServerTest, TestProcessRequestCompactResponse) {
+  const size_t desired_index = 3;
+  Plaintext pt(POLY_MODULUS_DEGREE);
+  pt.set_zero();
+  pt[desired_index] = 1;
+
+  vector<Ciphertext> query(1);
+  encryptor_->encrypt(pt, query[0]);
+
+  Request request_proto;
+  SaveRequest({query}, gal_keys_, relin_keys_, &request_proto);
+
+  ASSIGN_OR_FAIL(auto result_raw, server_->ProcessRequest(request_proto));
+  ASSERT_EQ(result_raw.reply_size(), 1);
+  ASSIGN_OR_FAIL(auto result, LoadCiphertexts(server_->Context()->SEALContext(),
+                                              result_raw.reply(0)));
+  ASSERT_THAT(result, SizeIs(1));
+
+  // With a 20 bit plaintext modulus and the default margin, one 36 bit prime
+  // of the default modulus is enough to decrypt the reply.
+  EXPECT_THAT(result[0].coeff_modulus_size(), Eq(1));
+  EXPECT_THAT(decryptor_->invariant_noise_budget(result[0]), Gt(0));
+  EXPECT_THAT(result_raw.reply(0).ByteSizeLong(),
+              Lt(request_proto.query(0).ByteSizeLong()));
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result[0], result_pt);
+  auto encoder = server_->Context()->Encoder();
+  ASSERT_THAT(encoder->decode_int64(result_pt),
+              Eq(int_db_[desired_index] * next_power_two(db_size_)));
+}
+
+TEST_F(PIRServerTest, TestProcessRequestCompactResponseMargin) {
+  const size_t desired_index = 3;
+  Plaintext pt(POLY_MODULUS_DEGREE);
+  pt.set_zero();
+  pt[desired_index] = 1;
+
+  vector<Ciphertext> query(1);
+  encryptor_->encrypt(pt, query[0]);
+
+  Request request_proto;
+  SaveRequest({query}, gal_keys_, relin_keys_, &request_proto);
+
+  // A larger margin doesn't fit into one prime, so the reply keeps two.
+  server_->set_response_noise_margin(2);
+  ASSIGN_OR_FAIL(auto result_raw, server_->ProcessRequest(request_proto));
+  ASSIGN_OR_FAIL(auto result, LoadCiphertexts(server_->Context()->SEALContext(),
+                                              result_raw.reply(0)));
+  ASSERT_THAT(result, SizeIs(1));
+  EXPECT_THAT(result[0].coeff_modulus_size(), Eq(2));
+  EXPECT_THAT(decryptor_->invariant_noise_budget(result[0]), Gt(0));
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result[0], result_pt);
+  auto encoder = server_->Context()->Encoder();
+  ASSERT_THAT(encoder->decode_int64(result_pt),
+              Eq(int_db_[desired_index] * next_power_two(db_size_)));
+}
+
+TEST_F(PIRServerTest, TestProcessRequestCompressedResponse) {
+  const size_t desired_index = 3;
+  Plaintext pt(POLY_MODULUS_DEGREE);
+  pt.set_zero();
+  pt[desired_index] = 1;
+
+  vector<Ciphertext> query(1);
+  encryptor_->encrypt(pt, query[0]);
+
+  Request request_proto;
+  SaveRequest({query}, gal_keys_, relin_keys_, &request_proto);
+  ASSIGN_OR_FAIL(auto plain_response, server_->ProcessRequest(request_proto));
+  EXPECT_THAT(plain_response.compression(), Eq(COMPRESSION_NONE));
+
+  request_proto.set_response_compression(COMPRESSION_DEFLATE);
+  ASSIGN_OR_FAIL(auto result_raw, server_->ProcessRequest(request_proto));
+  EXPECT_THAT(result_raw.compression(), Eq(COMPRESSION_DEFLATE));
+  ASSERT_EQ(result_raw.reply_size(), 1);
+  EXPECT_THAT(result_raw.reply(0).ByteSizeLong(),
+              Lt(plain_response.reply(0).ByteSizeLong()));
+
+  ASSIGN_OR_FAIL(auto result, LoadCiphertexts(server_->Context()->SEALContext(),
+                                              result_raw.reply(0)));
+  ASSERT_THAT(result, SizeIs(1));
+  Plaintext result_pt;
+  decryptor_->decrypt(result[0], result_pt);
+  auto encoder = server_->Context()->Encoder();
+  ASSERT_THAT(encoder->decode_int64(result_pt),
+              Eq(int_db_[desired_index] * next_power_two(db_size_)));
+}
+
 TEST_F(PIRServerTest, TestProcessRequest_MultiCT) {
   SetUpDB(5000);
   const size_t desired_index = 4200;
@@ -133,6 +228,49 @@ TEST_F(PIRServerTest, TestProcessRequest_MultiCT) {
                  next_power_two(db_size_ - POLY_MODULUS_DEGREE)));
 }
 
+class FusedExpansionTest : public PIRServerTest,
+                           public testing::WithParamInterface<bool> {};
+
+TEST_P(FusedExpansionTest, TestProcessRequest) {
+  SetUpDB(5000, 1, ELEM_SIZE, 20, GetParam());
+  server_->set_fused_expansion(true);
+  const vector<size_t> indexes = {4200, 7};
+  vector<vector<Ciphertext>> queries(indexes.size());
+  for (size_t idx = 0; idx < indexes.size(); ++idx) {
+    const size_t index = indexes[idx];
+    vector<Plaintext> pts(2, Plaintext(POLY_MODULUS_DEGREE));
+    pts[index / POLY_MODULUS_DEGREE][index % POLY_MODULUS_DEGREE] = 1;
+    queries[idx].resize(pts.size());
+    for (size_t c = 0; c < pts.size(); ++c) {
+      encryptor_->encrypt(pts[c], queries[idx][c]);
+    }
+  }
+
+  Request request_proto;
+  SaveRequest(queries, gal_keys_, relin_keys_, &request_proto);
+
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request_proto));
+  ASSERT_EQ(response.reply_size(), 2);
+  // Items in the second ciphertext are only expanded up to the next power of
+  // two of the items left.
+  const vector<size_t> m = {next_power_two(db_size_ - POLY_MODULUS_DEGREE),
+                            POLY_MODULUS_DEGREE};
+  for (size_t idx = 0; idx < indexes.size(); ++idx) {
+    ASSIGN_OR_FAIL(auto result,
+                   LoadCiphertexts(server_->Context()->SEALContext(),
+                                   response.reply(idx)));
+    ASSERT_THAT(result, SizeIs(1));
+
+    Plaintext result_pt;
+    decryptor_->decrypt(result[0], result_pt);
+    auto encoder = server_->Context()->Encoder();
+    EXPECT_THAT(encoder->decode_int64(result_pt),
+                Eq(int_db_[indexes[idx]] * m[idx]));
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(FusedExpansion, FusedExpansionTest, testing::Bool());
+
 TEST_F(PIRServerTest, TestProcessBatchRequest) {
   const vector<size_t> indexes = {3, 4, 5};
   vector<vector<Ciphertext>> queries(indexes.size());
@@ -165,6 +303,110 @@ TEST_F(PIRServerTest, TestProcessBatchRequest) {
   }
 }
 
+TEST_F(PIRServerTest, TestProcessBatchRequest_2DimNTT) {
+  SetUpDB(82, 2, ELEM_SIZE, 20, true);
+  // row and column of each desired index, in a 10 x 9 hypercube
+  const vector<size_t> indexes = {42, 0, 81};
+  vector<vector<Ciphertext>> queries(indexes.size());
+  for (size_t idx = 0; idx < indexes.size(); ++idx) {
+    Plaintext pt(POLY_MODULUS_DEGREE);
+    pt.set_zero();
+    pt[indexes[idx] / 9] = 1;
+    pt[10 + indexes[idx] % 9] = 1;
+
+    queries[idx].resize(1);
+    encryptor_->encrypt(pt, queries[idx][0]);
+  }
+
+  Request request_proto;
+  SaveRequest(queries, gal_keys_, relin_keys_, &request_proto);
+
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request_proto));
+  ASSERT_EQ(response.reply_size(), 3);
+  for (size_t idx = 0; idx < indexes.size(); ++idx) {
+    ASSIGN_OR_FAIL(auto result,
+                   LoadCiphertexts(server_->Context()->SEALContext(),
+                                   response.reply(idx)));
+    ASSERT_THAT(result, SizeIs(1));
+
+    Plaintext result_pt;
+    decryptor_->decrypt(result[0], result_pt);
+    auto encoder = server_->Context()->Encoder();
+    EXPECT_THAT(encoder->decode_int64(result_pt),
+                Eq(int_db_[indexes[idx]] * 32 * 32));
+  }
+}
+
+TEST_F(PIRServerTest, TestProcessBatchRequestParallel) {
+  SetUpDB(82, 2, ELEM_SIZE, 20, true);
+  auto pool = std::make_shared<ThreadPool>(4);
+  server_->set_thread_pool(pool);
+  pir_db_->set_thread_pool(pool);
+
+  const vector<size_t> indexes = {42, 0, 81, 17, 42, 63};
+  vector<vector<Ciphertext>> queries(indexes.size());
+  for (size_t idx = 0; idx < indexes.size(); ++idx) {
+    Plaintext pt(POLY_MODULUS_DEGREE);
+    pt.set_zero();
+    pt[indexes[idx] / 9] = 1;
+    pt[10 + indexes[idx] % 9] = 1;
+
+    queries[idx].resize(1);
+    encryptor_->encrypt(pt, queries[idx][0]);
+  }
+
+  Request request_proto;
+  SaveRequest(queries, gal_keys_, relin_keys_, &request_proto);
+
+  ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request_proto));
+  ASSERT_EQ(response.reply_size(), 6);
+  for (size_t idx = 0; idx < indexes.size(); ++idx) {
+    ASSIGN_OR_FAIL(auto result,
+                   LoadCiphertexts(server_->Context()->SEALContext(),
+                                   response.reply(idx)));
+    ASSERT_THAT(result, SizeIs(1));
+
+    Plaintext result_pt;
+    decryptor_->decrypt(result[0], result_pt);
+    auto encoder = server_->Context()->Encoder();
+    EXPECT_THAT(encoder->decode_int64(result_pt),
+                Eq(int_db_[indexes[idx]] * 32 * 32));
+  }
+}
+
+TEST_F(PIRServerTest, TestProcessRequestConcurrentUpdate) {
+  SetUpParams(100, 64);
+  GenerateDB();
+  SetUpSealTools();
+  server_ = PIRServer::Create(pir_db_, pir_params_).ValueOrDie();
+  auto client = PIRClient::Create(pir_params_).ValueOrDie();
+
+  // Both items share a plaintext, only the first one is updated.
+  const vector<size_t> indexes = {42, 43};
+  const string old_value = string_db_[indexes[0]];
+  const string new_value = generate_test_db(1, 64, 7)[0];
+  std::atomic<bool> done(false);
+  std::thread writer([&]() {
+    for (size_t i = 0; !done; ++i) {
+      EXPECT_OK(pir_db_->update(indexes[0], i % 2 ? old_value : new_value));
+    }
+  });
+
+  // Fatal failures return from the lambda, so the writer is always joined.
+  [&]() {
+    for (int i = 0; i < 4; ++i) {
+      ASSIGN_OR_FAIL(auto request, client->CreateRequest(indexes));
+      ASSIGN_OR_FAIL(auto response, server_->ProcessRequest(request));
+      ASSIGN_OR_FAIL(auto result, client->ProcessResponse(indexes, response));
+      ASSERT_THAT(result, SizeIs(2));
+      EXPECT_THAT(result[0], AnyOf(Eq(old_value), Eq(new_value)));
+      EXPECT_THAT(result[1], Eq(string_db_[indexes[1]]));
+    }
+  }();
+  done = true;
+  writer.join();
+}
+
 // Make sure that if we get a weird request from client nothing explodes.
 TEST_F(PIRServerTest, TestProcessRequestZeroInput) {
   Plaintext pt(POLY_MODULUS_DEGREE);
@@ -189,6 +431,81 @@ TEST_F(PIRServerTest, TestProcessRequestZeroInput) {
   ASSERT_THAT(encoder->decode_int64(result_pt), 0);
 }
 
+TEST_F(PIRServerTest, TestProcessRequestCachedKeys) {
+  server_->set_key_cache(std::make_shared<KeyCache>(4));
+  const size_t desired_index = 7;
+  Plaintext pt(POLY_MODULUS_DEGREE);
+  pt.set_zero();
+  pt[desired_index] = 1;
+
+  vector<Ciphertext> query(1);
+  encryptor_->encrypt(pt, query[0]);
+
+  Request request_proto;
+  SaveRequest({query}, gal_keys_, relin_keys_, &request_proto);
+  request_proto.set_key_id(KeyDigest(request_proto.galois_keys(),
+                                     request_proto.relin_keys()));
+
+  // Keys are only known once a request has carried them.
+  Request keyless_request = request_proto;
+  keyless_request.clear_galois_keys();
+  keyless_request.clear_relin_keys();
+  auto response_or = server_->ProcessRequest(keyless_request);
+  ASSERT_THAT(response_or.status().code(),
+              Eq(private_join_and_compute::StatusCode::kNotFound));
+
+  ASSERT_OK(server_->ProcessRequest(request_proto).status());
+
+  ASSIGN_OR_FAIL(auto result_raw, server_->ProcessRequest(keyless_request));
+  ASSERT_EQ(result_raw.reply_size(), 1);
+  ASSIGN_OR_FAIL(auto result, LoadCiphertexts(server_->Context()->SEALContext(),
+                                              result_raw.reply(0)));
+  ASSERT_THAT(result, SizeIs(1));
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result[0], result_pt);
+  auto encoder = server_->Context()->Encoder();
+  ASSERT_THAT(encoder->decode_int64(result_pt),
+              Eq(int_db_[desired_index] * next_power_two(db_size_)));
+}
+
+TEST_F(PIRServerTest, TestProcessRequestKeyIdMismatch) {
+  server_->set_key_cache(std::make_shared<KeyCache>(4));
+  Plaintext pt(POLY_MODULUS_DEGREE);
+  pt.set_zero();
+
+  vector<Ciphertext> query(1);
+  encryptor_->encrypt(pt, query[0]);
+
+  Request request_proto;
+  SaveRequest({query}, gal_keys_, relin_keys_, &request_proto);
+  request_proto.set_key_id(KeyDigest("some other", "keys"));
+
+  auto response_or = server_->ProcessRequest(request_proto);
+  ASSERT_THAT(response_or.status().code(),
+              Eq(private_join_and_compute::StatusCode::kInvalidArgument));
+}
+
+TEST_F(PIRServerTest, TestProcessRequestMissingGaloisKey) {
+  Plaintext pt(POLY_MODULUS_DEGREE);
+  pt.set_zero();
+
+  vector<Ciphertext> query(1);
+  encryptor_->encrypt(pt, query[0]);
+
+  // 10 items need 4 levels of expansion, leave out the key of the last one.
+  auto galois_elts = server_->Context()->GaloisElements();
+  ASSERT_THAT(galois_elts, SizeIs(4));
+  galois_elts.pop_back();
+
+  Request request_proto;
+  SaveRequest({query}, keygen_->galois_keys_local(galois_elts), &request_proto);
+
+  auto response_or = server_->ProcessRequest(request_proto);
+  ASSERT_THAT(response_or.status().code(),
+              Eq(private_join_and_compute::StatusCode::kInvalidArgument));
+}
+
 TEST_F(PIRServerTest, TestProcessRequest_2Dim) {
   SetUpDB(82, 2);
   const size_t desired_index = 42;
@@ -220,6 +537,33 @@ TEST_F(PIRServerTest, TestProcessRequest_2Dim) {
               Eq(int_db_[desired_index] * 32 * 32));
 }
 
+TEST_F(PIRServerTest, TestProcessRequest_2DimNTT) {
+  SetUpDB(82, 2, ELEM_SIZE, 20, true);
+  const size_t desired_index = 42;
+  Plaintext pt(POLY_MODULUS_DEGREE);
+  pt.set_zero();
+  pt[4] = 1;
+  pt[16] = 1;
+
+  vector<Ciphertext> query(1);
+  encryptor_->encrypt(pt, query[0]);
+
+  Request request_proto;
+  SaveRequest({query}, gal_keys_, relin_keys_, &request_proto);
+
+  ASSIGN_OR_FAIL(auto result_raw, server_->ProcessRequest(request_proto));
+  ASSERT_EQ(result_raw.reply_size(), 1);
+  ASSIGN_OR_FAIL(auto result, LoadCiphertexts(server_->Context()->SEALContext(),
+                                              result_raw.reply(0)));
+  ASSERT_THAT(result, SizeIs(1));
+
+  Plaintext result_pt;
+  decryptor_->decrypt(result[0], result_pt);
+  auto encoder = server_->Context()->Encoder();
+  ASSERT_THAT(encoder->decode_int64(result_pt),
+              Eq(int_db_[desired_index] * 32 * 32));
+}
+
 class SubstituteOperatorTest
     : public PIRServerTest,
       public testing::WithParamInterface<tuple<string, uint32_t, string>> {};
@@ -284,6 +628,39 @@ TEST_P(MultiplyInversePowerXTest, MultiplyInversePowerXExamples) {
   ASSERT_THAT(result_pt, Eq(expected_pt));
 }
 
+TEST_P(MultiplyInversePowerXTest, MultiplyInversePowerXInPlace) {
+  Plaintext input_pt(get<0>(GetParam()));
+  Ciphertext ct;
+  encryptor_->encrypt(input_pt, ct);
+
+  server_->multiply_inverse_power_of_x(ct, get<1>(GetParam()), ct);
+
+  Plaintext result_pt;
+  decryptor_->decrypt(ct, result_pt);
+  ASSERT_THAT(result_pt, Eq(Plaintext(get<2>(GetParam()))));
+}
+
+TEST_P(MultiplyInversePowerXTest, MultiplyInversePowerXNTT) {
+  Plaintext input_pt(get<0>(GetParam()));
+  Ciphertext ct;
+  encryptor_->encrypt(input_pt, ct);
+  auto evaluator = server_->Context()->Evaluator();
+  evaluator->transform_to_ntt_inplace(ct);
+
+  auto k = get<1>(GetParam());
+  Ciphertext result_ct;
+  server_->multiply_inverse_power_of_x(ct, k, result_ct);
+  ASSERT_TRUE(result_ct.is_ntt_form());
+  server_->multiply_inverse_power_of_x(ct, k, ct);
+
+  for (auto* result : {&result_ct, &ct}) {
+    evaluator->transform_from_ntt_inplace(*result);
+    Plaintext result_pt;
+    decryptor_->decrypt(*result, result_pt);
+    ASSERT_THAT(result_pt, Eq(Plaintext(get<2>(GetParam()))));
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(InversePowersOfX, MultiplyInversePowerXTest,
                          testing::Values(make_tuple("42x^1", 1, "42"),
                                          make_tuple("42x^42", 41, "42x^1"),
@@ -332,7 +709,11 @@ INSTANTIATE_TEST_SUITE_P(
                     make_tuple("3x^3 + 2x^2 + 1x^1 + 42",
                                vector<string>({"108", "4", "8", "C"})),
                     make_tuple("1x^5", vector<string>({"0", "0", "0", "0", "0",
-                                                       "8"}))));
+                                                       "8"})),
+                    make_tuple("5x^2", vector<string>({"0", "0", "14"})),
+                    make_tuple("1x^8 + 1x^1",
+                               vector<string>({"0", "10", "0", "0", "0", "0",
+                                               "0", "0", "10"}))));
 
 class ObliviousExpansionTestMultiCT
     : public PIRServerTest,
@@ -370,6 +751,38 @@ TEST_P(ObliviousExpansionTestMultiCT, MultiCTExamples) {
   }
 }
 
+TEST_P(ObliviousExpansionTestMultiCT, MultiCTExamplesParallel) {
+  const auto num_items = get<0>(GetParam());
+  const auto index = get<1>(GetParam());
+  const auto expected_value = get<2>(GetParam());
+  server_->set_thread_pool(std::make_shared<ThreadPool>(4));
+
+  vector<Plaintext> input_pt(num_items / POLY_MODULUS_DEGREE + 1,
+                             Plaintext(POLY_MODULUS_DEGREE));
+  input_pt[index / POLY_MODULUS_DEGREE][index % POLY_MODULUS_DEGREE] = 1;
+  vector<Ciphertext> input_ct(input_pt.size());
+  for (size_t i = 0; i < input_pt.size(); ++i) {
+    encryptor_->encrypt(input_pt[i], input_ct[i]);
+  }
+
+  ASSIGN_OR_FAIL(auto results,
+                 server_->oblivious_expansion(
+                     input_ct, num_items,
+                     keygen_->galois_keys_local(
+                         generate_galois_elts(POLY_MODULUS_DEGREE))));
+
+  ASSERT_THAT(results, SizeIs(num_items));
+  for (size_t i = 0; i < results.size(); ++i) {
+    Plaintext result_pt;
+    decryptor_->decrypt(results[i], result_pt);
+    const auto exp = (i == index) ? expected_value : 0;
+    EXPECT_THAT(result_pt.coeff_count(), Eq(1))
+        << "i = " << i << ", pt = " << result_pt.to_string();
+    EXPECT_THAT(result_pt[0], Eq(exp))
+        << "i = " << i << ", pt = " << result_pt.to_string();
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(
     ObliviousExpansionMultiCT, ObliviousExpansionTestMultiCT,
     testing::Values(make_tuple(100, 42, 128), make_tuple(100, 0, 128),
@@ -0,0 +1,190 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "util/canonical_errors.h"
+
+namespace pir {
+
+using private_join_and_compute::DataLossError;
+using private_join_and_compute::InternalError;
+using private_join_and_compute::NotFoundError;
+
+namespace {
+
+constexpr char kMagic[8] = {'P', 'I', 'R', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t kVersion = 1;
+
+// Plaintext slots start on a boundary of this size, so that they line up with
+// pages on all the platforms we care about.
+constexpr uint64_t kAlignment = 4096;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t params_size;
+  uint64_t num_plaintexts;
+  uint64_t slot_words;
+  uint64_t data_offset;
+};
+
+uint64_t align_up(uint64_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+}  // namespace
+
+Status DatabaseSnapshot::Write(const string& path, const PIRParameters& params,
+                               size_t num_plaintexts, size_t slot_words,
+                               const PlaintextData& plaintext_data) {
+  const string params_bytes = params.SerializeAsString();
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.params_size = params_bytes.size();
+  header.num_plaintexts = num_plaintexts;
+  header.slot_words = slot_words;
+  header.data_offset = align_up(sizeof(header) + params_bytes.size());
+
+  const string temp_path = path + ".tmp";
+  std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return InternalError("Unable to create snapshot file " + temp_path);
+  }
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out << params_bytes;
+  const std::vector<char> padding(
+      header.data_offset - sizeof(header) - params_bytes.size(), 0);
+  out.write(padding.data(), padding.size());
+
+  const std::vector<uint64_t> zeros(slot_words, 0);
+  for (size_t i = 0; i < num_plaintexts; ++i) {
+    size_t count = 0;
+    const uint64_t* data = plaintext_data(i, &count);
+    if (count > slot_words) {
+      out.close();
+      std::remove(temp_path.c_str());
+      return InternalError("Plaintext " + std::to_string(i) +
+                           " does not fit in a snapshot slot");
+    }
+    out.write(reinterpret_cast<const char*>(data), count * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(zeros.data()),
+              (slot_words - count) * sizeof(uint64_t));
+  }
+
+  out.close();
+  if (!out) {
+    std::remove(temp_path.c_str());
+    return InternalError("Error writing snapshot file " + temp_path);
+  }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return InternalError("Unable to move snapshot into place at " + path);
+  }
+  return Status::OK;
+}
+
+StatusOr<std::unique_ptr<DatabaseSnapshot>> DatabaseSnapshot::Open(
+    const string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return NotFoundError("Unable to open snapshot file " + path);
+  }
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0) {
+    ::close(fd);
+    return InternalError("Unable to stat snapshot file " + path);
+  }
+  const size_t file_size = file_stat.st_size;
+  if (file_size < sizeof(SnapshotHeader)) {
+    ::close(fd);
+    return DataLossError("Snapshot file " + path + " is truncated");
+  }
+
+  void* mapping = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed.
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return InternalError("Unable to map snapshot file " + path);
+  }
+  auto fail = [&](const string& reason) {
+    ::munmap(mapping, file_size);
+    return DataLossError("Snapshot file " + path + " " + reason);
+  };
+
+  auto* bytes = static_cast<char*>(mapping);
+  SnapshotHeader header;
+  std::memcpy(&header, bytes, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    return fail("is not a database snapshot");
+  }
+  if (header.version != kVersion) {
+    return fail("has unsupported version " + std::to_string(header.version));
+  }
+  // Checked on its own first, so that the sums below can't wrap around.
+  if (header.params_size > file_size - sizeof(header) ||
+      header.params_size > INT_MAX) {
+    return fail("is truncated or corrupt");
+  }
+  if (header.data_offset % kAlignment != 0 ||
+      header.data_offset < sizeof(header) + header.params_size ||
+      header.data_offset > file_size || header.slot_words == 0 ||
+      header.num_plaintexts >
+          (file_size - header.data_offset) / sizeof(uint64_t) /
+              header.slot_words) {
+    return fail("is truncated or corrupt");
+  }
+
+  PIRParameters params;
+  if (!params.ParseFromArray(bytes + sizeof(header),
+                            static_cast<int>(header.params_size))) {
+    return fail("has invalid parameters");
+  }
+
+  return std::unique_ptr<DatabaseSnapshot>(new DatabaseSnapshot(
+      mapping, file_size, params, header.num_plaintexts, header.slot_words,
+      reinterpret_cast<uint64_t*>(bytes + header.data_offset)));
+}
+
+DatabaseSnapshot::DatabaseSnapshot(void* mapping, size_t mapping_size,
+                                   const PIRParameters& params,
+                                   size_t num_plaintexts, size_t slot_words,
+                                   uint64_t* data)
+    : mapping_(mapping),
+      mapping_size_(mapping_size),
+      params_(params),
+      num_plaintexts_(num_plaintexts),
+      slot_words_(slot_words),
+      data_(data) {}
+
+DatabaseSnapshot::~DatabaseSnapshot() { ::munmap(mapping_, mapping_size_); }
+
+}  // namespace pir
@@ -0,0 +1,123 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PIR_SNAPSHOT_H_
+#define PIR_SNAPSHOT_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "pir/proto/payload.pb.h"
+#include "util/status.h"
+#include "util/statusor.h"
+
+namespace pir {
+
+using private_join_and_compute::Status;
+using private_join_and_compute::StatusOr;
+using std::string;
+
+/**
+ * On-disk snapshot of an encoded database. The file starts with a header
+ * holding the PIRParameters the database was encoded with, followed by one
+ * fixed size slot of coefficients per plaintext, starting on a page boundary.
+ * If preprocess_ntt is set in the parameters the coefficients are in NTT form.
+ *
+ * Snapshots are mapped copy-on-write into memory, so opening one doesn't copy
+ * or decode anything, and processes mapping the same file share its pages
+ * until they modify them. Changes are never written back to the file.
+ * Coefficients are stored in native byte order.
+ */
+class DatabaseSnapshot {
+ public:
+  /**
+   * Callback returning the coefficients of plaintext i, and their number
+   * through count. Slots are zero padded up to slot_words.
+   */
+  using PlaintextData =
+      std::function<const uint64_t*(size_t /*i*/, size_t* /*count*/)>;
+
+  /**
+   * Writes a snapshot to the given path. The file is written next to its
+   * destination and renamed into place, so readers never see a partial file.
+   * @param[in] path File to write.
+   * @param[in] params Parameters the plaintexts were encoded with.
+   * @param[in] num_plaintexts Number of plaintexts to write.
+   * @param[in] slot_words Number of coefficients reserved for each plaintext.
+   * @param[in] plaintext_data Source of the plaintext coefficients.
+   */
+  static Status Write(const string& path, const PIRParameters& params,
+                      size_t num_plaintexts, size_t slot_words,
+                      const PlaintextData& plaintext_data);
+
+  /**
+   * Maps a snapshot into memory.
+   * @param[in] path File to open.
+   * @returns NotFoundError if the file can't be opened, DataLossError if it
+   *    is not a valid snapshot.
+   */
+  static StatusOr<std::unique_ptr<DatabaseSnapshot>> Open(const string& path);
+
+  ~DatabaseSnapshot();
+  DatabaseSnapshot(const DatabaseSnapshot&) = delete;
+  DatabaseSnapshot& operator=(const DatabaseSnapshot&) = delete;
+
+  /**
+   * Parameters the snapshot was encoded with.
+   */
+  const PIRParameters& params() const { return params_; }
+
+  /**
+   * Number of plaintexts in the snapshot.
+   */
+  size_t size() const { return num_plaintexts_; }
+
+  /**
+   * Number of coefficients in each plaintext slot.
+   */
+  size_t slot_words() const { return slot_words_; }
+
+  /**
+   * Coefficients of plaintext i, slot_words() of them.
+   */
+  const uint64_t* plaintext(size_t i) const {
+    return data_ + i * slot_words_;
+  }
+
+  /**
+   * Writable coefficients of plaintext i. Only the pages written to are
+   * copied, and the copies are private to this process.
+   */
+  uint64_t* mutable_plaintext(size_t i) { return data_ + i * slot_words_; }
+
+ private:
+  DatabaseSnapshot(void* mapping, size_t mapping_size,
+                   const PIRParameters& params, size_t num_plaintexts,
+                   size_t slot_words, uint64_t* data);
+
+  void* mapping_;
+  size_t mapping_size_;
+  PIRParameters params_;
+  size_t num_plaintexts_;
+  size_t slot_words_;
+  uint64_t* data_;
+};
+
+}  // namespace pir
+
+#endif  // PIR_SNAPSHOT_H_
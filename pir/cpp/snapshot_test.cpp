@@ -0,0 +1,126 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/snapshot.h"
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "pir/cpp/status_asserts.h"
+
+namespace pir {
+namespace {
+
+using private_join_and_compute::StatusCode;
+using std::vector;
+using namespace ::testing;
+
+class DatabaseSnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    path_ = ::testing::TempDir() + "/snapshot_test";
+    params_.set_num_items(3);
+    params_.set_num_pt(3);
+    params_.add_dimensions(3);
+    params_.set_encryption_parameters("encryption parameters");
+    plaintexts_ = {{1, 2, 3, 4}, {5, 6}, {}};
+  }
+
+  void TearDown() { std::remove(path_.c_str()); }
+
+  Status WriteSnapshot(size_t slot_words) {
+    return DatabaseSnapshot::Write(
+        path_, params_, plaintexts_.size(), slot_words,
+        [this](size_t i, size_t* count) {
+          *count = plaintexts_[i].size();
+          return plaintexts_[i].data();
+        });
+  }
+
+  string path_;
+  PIRParameters params_;
+  vector<vector<uint64_t>> plaintexts_;
+};
+
+TEST_F(DatabaseSnapshotTest, TestWriteAndOpen) {
+  ASSERT_OK(WriteSnapshot(4));
+  auto snapshot_or = DatabaseSnapshot::Open(path_);
+  ASSERT_OK(snapshot_or.status());
+  auto snapshot = std::move(snapshot_or.ValueOrDie());
+
+  EXPECT_EQ(snapshot->params().SerializeAsString(),
+            params_.SerializeAsString());
+  ASSERT_EQ(snapshot->size(), 3u);
+  ASSERT_EQ(snapshot->slot_words(), 4u);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(snapshot->plaintext(0)) % 4096, 0u);
+  EXPECT_THAT(vector<uint64_t>(snapshot->plaintext(0),
+                               snapshot->plaintext(0) + 4),
+              ElementsAre(1, 2, 3, 4));
+  EXPECT_THAT(vector<uint64_t>(snapshot->plaintext(1),
+                               snapshot->plaintext(1) + 4),
+              ElementsAre(5, 6, 0, 0));
+  EXPECT_THAT(vector<uint64_t>(snapshot->plaintext(2),
+                               snapshot->plaintext(2) + 4),
+              ElementsAre(0, 0, 0, 0));
+}
+
+TEST_F(DatabaseSnapshotTest, TestPlaintextTooBig) {
+  auto status = WriteSnapshot(3);
+  EXPECT_EQ(status.code(), StatusCode::kInternal);
+  EXPECT_EQ(DatabaseSnapshot::Open(path_).status().code(),
+            StatusCode::kNotFound);
+}
+
+TEST_F(DatabaseSnapshotTest, TestOpenMissing) {
+  EXPECT_EQ(DatabaseSnapshot::Open(path_).status().code(),
+            StatusCode::kNotFound);
+}
+
+TEST_F(DatabaseSnapshotTest, TestOpenNotASnapshot) {
+  std::ofstream(path_) << "this is not a database snapshot, but it is long "
+                          "enough to hold a snapshot header";
+  EXPECT_EQ(DatabaseSnapshot::Open(path_).status().code(),
+            StatusCode::kDataLoss);
+}
+
+TEST_F(DatabaseSnapshotTest, TestOpenTruncated) {
+  ASSERT_OK(WriteSnapshot(4));
+  std::ifstream in(path_, std::ios::binary);
+  const string contents((std::istreambuf_iterator<char>(in)),
+                        std::istreambuf_iterator<char>());
+  std::ofstream(path_, std::ios::binary | std::ios::trunc)
+      << contents.substr(0, contents.size() - 1);
+  EXPECT_EQ(DatabaseSnapshot::Open(path_).status().code(),
+            StatusCode::kDataLoss);
+}
+
+TEST_F(DatabaseSnapshotTest, TestOpenCorruptParamsSize) {
+  ASSERT_OK(WriteSnapshot(4));
+  // A parameter size that wraps around when the header size is added to it,
+  // written over the params_size field that follows magic and version.
+  const uint64_t params_size = ~uint64_t{0} - 7;
+  std::fstream file(path_, std::ios::binary | std::ios::in | std::ios::out);
+  file.seekp(16);
+  file.write(reinterpret_cast<const char*>(&params_size), sizeof(params_size));
+  file.close();
+  EXPECT_EQ(DatabaseSnapshot::Open(path_).status().code(),
+            StatusCode::kDataLoss);
+}
+
+}  // namespace
+}  // namespace pir
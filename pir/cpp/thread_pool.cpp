@@ -0,0 +1,144 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "pir/cpp/utils.h"
+#include "util/canonical_errors.h"
+
+namespace pir {
+
+using ::private_join_and_compute::InternalError;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  workers_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return shutdown_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+namespace {
+
+/**
+ * State shared between the threads working on one ParallelFor call. Helpers
+ * queued on the pool may start after the call has returned, so everything
+ * they touch is owned here rather than by the caller.
+ */
+struct ParallelForState {
+  ParallelForState(size_t n, std::function<Status(size_t)> fn)
+      : n(n), fn(std::move(fn)) {}
+
+  const size_t n;
+  const std::function<Status(size_t)> fn;
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  size_t done = 0;
+  Status status;
+};
+
+void RunParallelFor(ParallelForState* state) {
+  size_t i;
+  while ((i = state->next++) < state->n) {
+    Status status;
+    // no point starting more work once something failed
+    if (!state->failed) {
+      try {
+        status = state->fn(i);
+      } catch (const std::exception& e) {
+        status = InternalError(e.what());
+      }
+    }
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (!status.ok() && state->status.ok()) {
+      state->status = status;
+      state->failed = true;
+    }
+    if (++state->done == state->n) {
+      state->done_cv.notify_all();
+    }
+  }
+}
+
+}  // namespace
+
+Status ParallelFor(ThreadPool* pool, size_t n,
+                   const std::function<Status(size_t)>& fn) {
+  if (pool == nullptr || n <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      try {
+        RETURN_IF_ERROR(fn(i));
+      } catch (const std::exception& e) {
+        return InternalError(e.what());
+      }
+    }
+    return Status::OK;
+  }
+
+  auto state = std::make_shared<ParallelForState>(n, fn);
+  const size_t num_helpers = std::min(pool->num_threads(), n - 1);
+  for (size_t i = 0; i < num_helpers; ++i) {
+    pool->Schedule([state] { RunParallelFor(state.get()); });
+  }
+  RunParallelFor(state.get());
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->done_cv.wait(lock, [&state] { return state->done == state->n; });
+  return state->status;
+}
+
+}  // namespace pir
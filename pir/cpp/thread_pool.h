@@ -0,0 +1,89 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PIR_THREAD_POOL_H_
+#define PIR_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/status.h"
+
+namespace pir {
+
+using ::private_join_and_compute::Status;
+
+/**
+ * Fixed-size pool of worker threads, used to spread independent homomorphic
+ * operations across cores.
+ */
+class ThreadPool {
+ public:
+  /**
+   * Creates a pool and starts its workers.
+   * @param[in] num_threads Number of worker threads. If zero, the number of
+   *    hardware threads is used.
+   */
+  explicit ThreadPool(size_t num_threads = 0);
+
+  /**
+   * Finishes all queued tasks and joins the workers.
+   */
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * Queues a task to be run by one of the workers.
+   */
+  void Schedule(std::function<void()> task);
+
+  /**
+   * Number of worker threads in the pool.
+   */
+  size_t num_threads() const { return workers_.size(); }
+
+ private:
+  void WorkerLoop();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool shutdown_ = false;
+  std::vector<std::thread> workers_;
+};
+
+/**
+ * Calls fn(i) for every i in [0, n), spreading the calls over the pool. The
+ * calling thread works through the range as well, so this may be called from a
+ * task that is itself running on the pool. If pool is nullptr, all calls are
+ * made on the calling thread.
+ * @param[in] pool Pool to use, or nullptr.
+ * @param[in] n Number of calls to make.
+ * @param[in] fn Function to call. Exceptions are turned into InternalError.
+ * @returns The first error returned by fn, or OK.
+ */
+Status ParallelFor(ThreadPool* pool, size_t n,
+                   const std::function<Status(size_t)>& fn);
+
+}  // namespace pir
+
+#endif  // PIR_THREAD_POOL_H_
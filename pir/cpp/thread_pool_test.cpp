@@ -0,0 +1,103 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "pir/cpp/thread_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "pir/cpp/status_asserts.h"
+#include "util/canonical_errors.h"
+
+namespace pir {
+namespace {
+
+using ::private_join_and_compute::InvalidArgumentError;
+using ::private_join_and_compute::StatusCode;
+using ::testing::Each;
+using ::testing::Eq;
+using std::vector;
+
+TEST(ThreadPoolTest, TestSchedule) {
+  std::atomic<int> count{0};
+  {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.num_threads(), 4);
+    for (int i = 0; i < 100; ++i) {
+      pool.Schedule([&count] { ++count; });
+    }
+  }
+  EXPECT_EQ(count, 100);
+}
+
+TEST(ThreadPoolTest, TestDefaultNumThreads) {
+  ThreadPool pool;
+  EXPECT_GE(pool.num_threads(), 1);
+}
+
+TEST(ThreadPoolTest, TestParallelFor) {
+  ThreadPool pool(4);
+  vector<int> calls(1000, 0);
+  EXPECT_OK(ParallelFor(&pool, calls.size(), [&calls](size_t i) {
+    ++calls[i];
+    return Status::OK;
+  }));
+  EXPECT_THAT(calls, Each(Eq(1)));
+}
+
+TEST(ThreadPoolTest, TestParallelForNoPool) {
+  vector<int> calls(10, 0);
+  EXPECT_OK(ParallelFor(nullptr, calls.size(), [&calls](size_t i) {
+    ++calls[i];
+    return Status::OK;
+  }));
+  EXPECT_THAT(calls, Each(Eq(1)));
+}
+
+TEST(ThreadPoolTest, TestParallelForError) {
+  ThreadPool pool(4);
+  auto status = ParallelFor(&pool, 100, [](size_t i) {
+    if (i == 42) return InvalidArgumentError("bad index");
+    return Status::OK;
+  });
+  EXPECT_EQ(status.code(), StatusCode::kInvalidArgument);
+}
+
+TEST(ThreadPoolTest, TestParallelForException) {
+  auto status = ParallelFor(nullptr, 1, [](size_t) -> Status {
+    throw std::invalid_argument("oops");
+  });
+  EXPECT_EQ(status.code(), StatusCode::kInternal);
+}
+
+// Calling ParallelFor from a task already running on the pool must not
+// deadlock, even when every worker is busy with an outer task.
+TEST(ThreadPoolTest, TestNestedParallelFor) {
+  ThreadPool pool(2);
+  std::atomic<int> count{0};
+  EXPECT_OK(ParallelFor(&pool, 8, [&pool, &count](size_t) {
+    return ParallelFor(&pool, 8, [&count](size_t) {
+      ++count;
+      return Status::OK;
+    });
+  }));
+  EXPECT_EQ(count, 64);
+}
+
+}  // namespace
+}  // namespace pir
@@ -0,0 +1,113 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/zero_encryption_pool.h"
+
+#include "util/canonical_errors.h"
+
+namespace pir {
+
+using ::private_join_and_compute::InternalError;
+using seal::Ciphertext;
+
+ZeroEncryptionPool::ZeroEncryptionPool(
+    std::shared_ptr<seal::Encryptor> encryptor, const Options& options)
+    : encryptor_(std::move(encryptor)), options_(options) {
+  if (options_.background_refill && options_.depth > 0) {
+    refill_thread_ = std::thread(&ZeroEncryptionPool::RefillLoop, this);
+  }
+}
+
+ZeroEncryptionPool::~ZeroEncryptionPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  cv_.notify_all();
+  if (refill_thread_.joinable()) {
+    refill_thread_.join();
+  }
+}
+
+Status ZeroEncryptionPool::Pop(Ciphertext& destination) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_.empty()) {
+      destination = std::move(ready_.front());
+      ready_.pop_front();
+      cv_.notify_all();
+      return Status::OK;
+    }
+  }
+  try {
+    encryptor_->encrypt_zero(destination);
+  } catch (const std::exception& e) {
+    return InternalError(e.what());
+  }
+  return Status::OK;
+}
+
+Status ZeroEncryptionPool::Fill() {
+  while (size() < options_.depth) {
+    Ciphertext ct;
+    try {
+      encryptor_->encrypt_zero(ct);
+    } catch (const std::exception& e) {
+      return InternalError(e.what());
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ready_.size() < options_.depth) {
+      ready_.push_back(std::move(ct));
+    }
+  }
+  return Status::OK;
+}
+
+size_t ZeroEncryptionPool::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ready_.size();
+}
+
+void ZeroEncryptionPool::RefillLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool refilling = true;
+  while (!shutdown_) {
+    if (ready_.size() >= options_.depth) {
+      refilling = false;
+    } else if (ready_.size() < options_.refill_threshold) {
+      refilling = true;
+    }
+    if (!refilling) {
+      cv_.wait(lock);
+      continue;
+    }
+
+    // Encrypt without holding the lock, so that Pop isn't blocked meanwhile.
+    lock.unlock();
+    Ciphertext ct;
+    try {
+      encryptor_->encrypt_zero(ct);
+    } catch (const std::exception&) {
+      // Pop reports the error when it encrypts on the calling thread instead.
+      return;
+    }
+    lock.lock();
+    if (ready_.size() < options_.depth) {
+      ready_.push_back(std::move(ct));
+    }
+  }
+}
+
+}  // namespace pir
@@ -0,0 +1,107 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PIR_ZERO_ENCRYPTION_POOL_H_
+#define PIR_ZERO_ENCRYPTION_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "seal/seal.h"
+#include "util/status.h"
+
+namespace pir {
+
+using ::private_join_and_compute::Status;
+
+/**
+ * Queue of fresh public key encryptions of zero, computed ahead of time so
+ * that encrypting a plaintext only takes adding it to one of them. Each
+ * encryption is handed out once. The queue can be refilled by a background
+ * thread, or explicitly by calling Fill, for instance while the application is
+ * idle. Thread safe.
+ */
+class ZeroEncryptionPool {
+ public:
+  struct Options {
+    // Maximum number of encryptions kept in the queue.
+    size_t depth = 16;
+
+    // The background thread starts refilling the queue once it holds fewer
+    // than this many encryptions, and then tops it up to depth. The default
+    // of depth refills after every Pop. Lower values refill in bursts.
+    size_t refill_threshold = 16;
+
+    // If false, there is no background thread, and the queue is only filled
+    // by calls to Fill.
+    bool background_refill = true;
+  };
+
+  /**
+   * Creates a pool, and starts the background thread if asked to. The queue
+   * starts empty.
+   * @param[in] encryptor Encryptor with a public key to encrypt zeros with.
+   * @param[in] options Depth and refill policy.
+   */
+  ZeroEncryptionPool(std::shared_ptr<seal::Encryptor> encryptor,
+                     const Options& options);
+
+  /**
+   * Stops the background thread, waiting for the encryption in progress.
+   */
+  ~ZeroEncryptionPool();
+
+  ZeroEncryptionPool(const ZeroEncryptionPool&) = delete;
+  ZeroEncryptionPool& operator=(const ZeroEncryptionPool&) = delete;
+
+  /**
+   * Takes an encryption of zero from the queue, or encrypts one on the
+   * calling thread if the queue is empty.
+   * @param[out] destination Encryption of zero.
+   * @returns InternalError if the encryption fails.
+   */
+  Status Pop(seal::Ciphertext& destination);
+
+  /**
+   * Fills the queue up to its depth on the calling thread.
+   * @returns InternalError if the encryption fails.
+   */
+  Status Fill();
+
+  /**
+   * Number of encryptions in the queue.
+   */
+  size_t size() const;
+
+ private:
+  void RefillLoop();
+
+  std::shared_ptr<seal::Encryptor> encryptor_;
+  const Options options_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<seal::Ciphertext> ready_;
+  bool shutdown_ = false;
+  std::thread refill_thread_;
+};
+
+}  // namespace pir
+
+#endif  // PIR_ZERO_ENCRYPTION_POOL_H_
@@ -0,0 +1,118 @@
+//
+// Copyright 2020 the authors listed in CONTRIBUTORS.md
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "pir/cpp/zero_encryption_pool.h"
+
+#include <chrono>
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "pir/cpp/parameters.h"
+#include "pir/cpp/status_asserts.h"
+
+namespace pir {
+namespace {
+
+using ::seal::Ciphertext;
+using ::seal::Plaintext;
+using ::testing::Eq;
+using ::testing::Le;
+
+class ZeroEncryptionPoolTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    auto sealctx = seal::SEALContext::Create(GenerateEncryptionParams());
+    keygen_ = std::make_unique<seal::KeyGenerator>(sealctx);
+    encryptor_ =
+        std::make_shared<seal::Encryptor>(sealctx, keygen_->public_key());
+    decryptor_ =
+        std::make_unique<seal::Decryptor>(sealctx, keygen_->secret_key());
+  }
+
+  void ExpectZero(const Ciphertext& ct) {
+    Plaintext pt;
+    decryptor_->decrypt(ct, pt);
+    EXPECT_TRUE(pt.is_zero());
+  }
+
+  std::unique_ptr<seal::KeyGenerator> keygen_;
+  std::shared_ptr<seal::Encryptor> encryptor_;
+  std::unique_ptr<seal::Decryptor> decryptor_;
+};
+
+TEST_F(ZeroEncryptionPoolTest, TestFill) {
+  ZeroEncryptionPool::Options options;
+  options.depth = 3;
+  options.background_refill = false;
+  ZeroEncryptionPool pool(encryptor_, options);
+  EXPECT_THAT(pool.size(), Eq(0u));
+
+  ASSERT_OK(pool.Fill());
+  EXPECT_THAT(pool.size(), Eq(3u));
+
+  Ciphertext first, second;
+  ASSERT_OK(pool.Pop(first));
+  ASSERT_OK(pool.Pop(second));
+  EXPECT_THAT(pool.size(), Eq(1u));
+  ExpectZero(first);
+  ExpectZero(second);
+  // Every encryption is handed out only once.
+  EXPECT_FALSE(std::equal(first.data(),
+                          first.data() + first.poly_modulus_degree(),
+                          second.data()));
+}
+
+TEST_F(ZeroEncryptionPoolTest, TestPopFromEmpty) {
+  ZeroEncryptionPool::Options options;
+  options.background_refill = false;
+  ZeroEncryptionPool pool(encryptor_, options);
+
+  Ciphertext ct;
+  ASSERT_OK(pool.Pop(ct));
+  EXPECT_THAT(pool.size(), Eq(0u));
+  ExpectZero(ct);
+}
+
+TEST_F(ZeroEncryptionPoolTest, TestBackgroundRefill) {
+  ZeroEncryptionPool::Options options;
+  options.depth = 4;
+  options.refill_threshold = 2;
+  ZeroEncryptionPool pool(encryptor_, options);
+
+  auto wait_for_size = [&pool](size_t size) {
+    for (int i = 0; i < 1000 && pool.size() != size; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return pool.size();
+  };
+  EXPECT_THAT(wait_for_size(4), Eq(4u));
+
+  // Above the threshold nothing is refilled.
+  Ciphertext ct;
+  ASSERT_OK(pool.Pop(ct));
+  ASSERT_OK(pool.Pop(ct));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_THAT(pool.size(), Eq(2u));
+  ExpectZero(ct);
+
+  // Below it the pool is topped up again.
+  ASSERT_OK(pool.Pop(ct));
+  EXPECT_THAT(pool.size(), Le(4u));
+  EXPECT_THAT(wait_for_size(4), Eq(4u));
+}
+
+}  // namespace
+}  // namespace pir
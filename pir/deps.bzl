@@ -69,6 +69,20 @@ def pir_deps():
             ],
         )
 
+    # Built here rather than fetched by SEAL's CMake at configure time, which
+    # it would do with SEAL_BUILD_DEPS on.
+    if "net_zlib" not in native.existing_rules():
+        http_archive(
+            name = "net_zlib",
+            build_file = "//third_party:zlib.BUILD",
+            sha256 = "c3e5e9fdd5004dcb542feda5ee4f0ff0744628baf8ed2dd5d66f8ca1197cb1a1",
+            strip_prefix = "zlib-1.2.11",
+            urls = [
+                "https://mirror.bazel.build/zlib.net/zlib-1.2.11.tar.gz",
+                "https://zlib.net/zlib-1.2.11.tar.gz",
+            ],
+        )
+
     if "com_microsoft_seal" not in native.existing_rules():
         http_archive(
             name = "com_microsoft_seal",